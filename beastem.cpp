@@ -89,8 +89,14 @@ void printHelp() {
     std::cout << "   -s <audio-sample-rate>         : Override the default audio sample rate (22050)" << std::endl;
     std::cout << "   -v <Audio volume>              : Value 0 to 10 (default 5)" << std::endl;
     std::cout << "   -k <CPU speed>                 : Integer KHz (default 8000)" << std::endl;
-    std::cout << "   -b <breakpoint>                : Stop at address (hex)" << std::endl;
+    std::cout << "   -b <breakpoint>                : Stop at address (hex) or label" << std::endl;
     std::cout << "   -z <zoom-level>                : Zoom the user interface by the given value" << std::endl;
+    std::cout << "   -x <frames>|auto               : VideoBeast frames to skip between drawn frames (default auto)" << std::endl;
+    std::cout << "   -t                             : Render VideoBeast on a separate thread" << std::endl;
+    std::cout << "   -c <pattern>                   : Capture VideoBeast frames to numbered .ppm or .png files, eg. frame%05d.png" << std::endl;
+    std::cout << "   -y <filename>                  : Capture VideoBeast video to a Y4M file or named pipe" << std::endl;
+    std::cout << "   -u <baud>|max                  : Move serial data a byte at a time at this rate, not at the UART's rate" << std::endl;
+    std::cout << "   -p <serial>                    : Serial connection, tcp[:port] (default tcp:8456), pty[:path], stdio or file:filename[,rate]" << std::endl;
 }
 
 struct BIN_FILE {
@@ -105,8 +111,14 @@ int main( int argc, char *argv[] ) {
     int sampleRate = Beast::AUDIO_FREQ;
     int volume = 4;
     float zoom = 1.0;
+    int frameSkip = VideoBeast::FRAME_SKIP_AUTO;
+    bool threadedVideo = false;
+    FrameCapture *capture = nullptr;
+    uint64_t fastSerialBaud = UART_FAST_OFF;
+    SerialBackend *serialBackend = nullptr;
     
     uint64_t breakpoint = Beast::NO_BREAKPOINT;
+    const char *breakpointArg = nullptr;
     Listing listing;
     VideoBeast *videoBeast = nullptr;
 
@@ -190,12 +202,13 @@ int main( int argc, char *argv[] ) {
             targetSpeed = std::stoi(argv[index], nullptr, 10);
         }
         else if( strcmp(argv[index], "-b") == 0 ) {
-            if( index+1 >= argc || !isHexNum(argv[++index]) ) {
-                std::cout << "Breakpoint: missing argument. Expected breakpoint address in hex." << std::endl;
+            if( index+1 >= argc ) {
+                std::cout << "Breakpoint: missing argument. Expected breakpoint address in hex, or a label." << std::endl;
                 printHelp();
                 exit(1);
             }
-            breakpoint = std::stoi(argv[index], nullptr, 16);
+            // Resolved once all listings are loaded
+            breakpointArg = argv[++index];
         }
         else if( strcmp(argv[index], "-a") == 0 ) {
             if( index+1 >= argc || !isNum(argv[++index]) ) {
@@ -221,6 +234,88 @@ int main( int argc, char *argv[] ) {
             }
             zoom = std::stof(argv[index], nullptr);
         }
+        else if( strcmp(argv[index], "-x") == 0 ) {
+            if( index+1 >= argc ) {
+                std::cout << "Frame skip: expected number of frames, or auto" << std::endl;
+                printHelp();
+                exit(1);
+            }
+            index++;
+            if( strcmp(argv[index], "auto") == 0 ) {
+                frameSkip = VideoBeast::FRAME_SKIP_AUTO;
+            }
+            else if( isNum(argv[index]) ) {
+                frameSkip = std::stoi(argv[index], nullptr, 10);
+            }
+            else {
+                std::cout << "Frame skip: expected number of frames, or auto" << std::endl;
+                printHelp();
+                exit(1);
+            }
+        }
+        else if( strcmp(argv[index], "-t") == 0 ) {
+            threadedVideo = true;
+        }
+        else if( strcmp(argv[index], "-c") == 0 ) {
+            if( index+1 >= argc ) {
+                std::cout << "Capture: expected file name pattern, eg. frame%05d.png" << std::endl;
+                printHelp();
+                exit(1);
+            }
+            if( capture == nullptr ) {
+                capture = new FrameCapture();
+            }
+            if( !capture->setImagePattern(argv[++index]) ) {
+                std::cout << "Capture: file name pattern needs one frame number, eg. %05d, and a .ppm or .png extension" << std::endl;
+                exit(1);
+            }
+        }
+        else if( strcmp(argv[index], "-y") == 0 ) {
+            if( index+1 >= argc ) {
+                std::cout << "Video capture: expected file name" << std::endl;
+                printHelp();
+                exit(1);
+            }
+            if( capture == nullptr ) {
+                capture = new FrameCapture();
+            }
+            capture->setStream(argv[++index]);
+        }
+        else if( strcmp(argv[index], "-u") == 0 ) {
+            if( index+1 >= argc ) {
+                std::cout << "Fast serial: expected Baud rate, or max" << std::endl;
+                printHelp();
+                exit(1);
+            }
+            index++;
+            if( strcmp(argv[index], "max") == 0 ) {
+                fastSerialBaud = UART_FAST_MAX;
+            }
+            else if( isNum(argv[index]) && std::stoull(argv[index], nullptr, 10) > 0 ) {
+                fastSerialBaud = std::stoull(argv[index], nullptr, 10);
+            }
+            else {
+                std::cout << "Fast serial: expected Baud rate, or max" << std::endl;
+                printHelp();
+                exit(1);
+            }
+        }
+        else if( strcmp(argv[index], "-p") == 0 ) {
+            if( index+1 >= argc ) {
+                std::cout << "Serial: expected tcp[:port], pty[:path], stdio or file:filename[,rate]" << std::endl;
+                printHelp();
+                exit(1);
+            }
+            delete serialBackend;
+            serialBackend = SerialBackend::create(argv[++index]);
+            if( serialBackend == nullptr ) {
+                exit(1);
+            }
+            // Serial data has standard output to itself, so messages go to standard error
+            if( serialBackend->usesStdout() ) {
+                std::cout.rdbuf(std::cerr.rdbuf());
+            }
+        }
         else if( strcmp(argv[index], "-h") == 0 ) {
             printHelp();
             exit(1);
@@ -240,6 +335,23 @@ int main( int argc, char *argv[] ) {
         binaries.push_back(BIN_FILE{"flash_v1.5.bin", 0});
     }
 
+    if( breakpointArg ) {
+        uint32_t address;
+        if( listing.lookupSymbol(breakpointArg, address) ) {
+            breakpoint = address & 0xFFFF;
+            std::cout << "Breakpoint " << breakpointArg << " at 0x" << std::hex << breakpoint << std::dec << std::endl;
+        }
+        else if( strspn(breakpointArg, "0123456789abcdefABCDEF") == strlen(breakpointArg) ) {
+            breakpoint = std::stoi(breakpointArg, nullptr, 16);
+        }
+        else {
+            std::cout << "Breakpoint: '" << breakpointArg << "' is not a hex address or a label in any listing" << std::endl;
+            exit(1);
+        }
+    }
+
+    listing.watch();
+
     SDL_Init( SDL_INIT_EVERYTHING );
 
     SDL_Window *window = SDL_CreateWindow("Feersum MicroBeast Emulator (Beta) v1.0", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, WIDTH*zoom, HEIGHT*zoom, SDL_WINDOW_ALLOW_HIGHDPI);
@@ -259,10 +371,26 @@ int main( int argc, char *argv[] ) {
         readBinary(bf.address, bf.filename, beast);
     }
 
+    if( videoBeast ) {
+        videoBeast->setFrameSkip(frameSkip);
+        videoBeast->setThreaded(threadedVideo);
+        videoBeast->setCapture(capture);
+    }
+    else if( capture ) {
+        std::cout << "Capture: VideoBeast is not enabled, use -d" << std::endl;
+        exit(1);
+    }
+
+    beast.setFastSerial(fastSerialBaud);
+    beast.setSerialBackend(serialBackend);
     beast.init(targetSpeed*ONE_KILOHERTZ, breakpoint, audioDevice, volume, sampleRate, videoBeast);
 
     beast.mainLoop();
 
+    // Stops the renderer, then lets the capture writer finish the frames it has queued
+    delete videoBeast;
+    delete capture;
+
     SDL_DestroyWindow( window );
     SDL_Quit();
 
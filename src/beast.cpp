@@ -3,6 +3,7 @@
 #include <cstring>
 #include <stdio.h>
 #include <iomanip>
+#include <algorithm>
 #include "z80.h"
 #include "z80pio.h"
 #include "listing.hpp"
@@ -110,13 +111,16 @@ void Beast::init(uint64_t targetSpeedHz, uint64_t breakpoint, int audioDevice, i
         display2->addDigit(getDigit(i+12));
     }
 
-    uart_init(&uart, UINT64_C(1843200), clock_time_ps);
+    uart_init(&uart, UINT64_C(1843200), clock_time_ps, serialBackend ? serialBackend : new TcpSerial(TcpSerial::DEFAULT_PORT));
+    uart_set_fast(&uart, fastSerialBaud);
     
     if( videoBeast ) {
-        videoBeast->init(clock_time_ps);
+        videoBeast->init(clock_time_ps, clock_cycle_ps);
         nextVideoBeastTickPs = 0;
     }
 
+    verifyListing();
+
     if( sampleRate > 0 ) {
         audioSampleRatePs = UINT64_C(1000000000000) / sampleRate;
         this->volume = volume;
@@ -168,12 +172,21 @@ void Beast::loadSamples(Sint16 *stream, int length) {
 
 Beast::~Beast() {
     SDL_CloseAudio();
+    uart_close(&uart);
     if( audioFile ) {
         fclose(audioFile);
         audioFile = nullptr;
     }
 }
 
+void Beast::setFastSerial(uint64_t baud) {
+    fastSerialBaud = baud;
+}
+
+void Beast::setSerialBackend(SerialBackend *backend) {
+    serialBackend = backend;
+}
+
 uint8_t *Beast::getRom() {
     return rom;
 }
@@ -182,6 +195,19 @@ uint8_t *Beast::getRam() {
     return ram;
 }
 
+// Physical ROM and RAM pages, for checking listings against memory
+const uint8_t *Beast::pageMemory(int page, uint32_t &generation) {
+    if( page >= MEMORY_PAGES ) {
+        return nullptr;
+    }
+    generation = pageGeneration[page];
+    return (page < 0x20) ? rom + (page << 14) : ram + ((page & 0x1F) << 14);
+}
+
+void Beast::verifyListing() {
+    listing.verify([this](int page, uint32_t &generation) { return pageMemory(page, generation); });
+}
+
 Digit *Beast::getDigit(int index) {
     return &display[index];
 }
@@ -288,67 +314,56 @@ void Beast::mainLoop() {
             mode = DEBUG;
         }
         else if( mode == OUT ) {
-            instr->resetStack();
-            bool isOut = false;
-            uint64_t tickCount = 0;
-            do {
-                if( z80_opdone(&cpu)) {
-                    isOut = instr->isOut(readMem(cpu.pc-1), readMem(cpu.pc));
-                }
-                tickCount = run(false, tickCount);
-            }
-            while( !z80_opdone(&cpu) || (!isOut && mode == OUT) );
-            mode = DEBUG;
+            // Stop once a return unwinds the stack past the current frame
+            stepStackPointer = cpu.sp;
+            stepReturning = instr->isReturn(readMem(cpu.pc-1), readMem(cpu.pc));
+            runUntilTrigger();
         }
         else if( mode == OVER ) {
-            while( !z80_opdone(&cpu) ) {
-                run(false, 0);
-            }
-            if( instr->isJumpOrReturn(readMem(cpu.pc-1), readMem(cpu.pc)) ) {
+            uint8_t op1 = readMem(cpu.pc-1);
+            uint8_t op2 = readMem(cpu.pc);
+            if( instr->isJumpOrReturn(op1, op2) ) {
                 // Unconditional jump/return.. always step..
                 std::cout << "Unconditional jump, stepping" << std::endl;
                 mode = STEP;
                 continue;
             }
-            else {
-                int length = instr->instructionLength(readMem(cpu.pc-1), readMem(cpu.pc));
-                if( length < 0 ) {
-                    std::cout << "Instruction length unknown, stepping";
-                    mode = STEP;
-                    continue;
-                }
-                uint16_t breakPoint = cpu.pc+length;
-                uint64_t tickCount = 0;
-                do {
-                    tickCount = run(false, tickCount);
-                }
-                while( !z80_opdone(&cpu) || (cpu.pc != breakPoint && mode == OVER) );
+            int length = instr->instructionLength(op1, op2);
+            if( length < 0 ) {
+                std::cout << "Instruction length unknown, stepping";
+                mode = STEP;
+                continue;
             }
-            mode = DEBUG;
+            stepBreakpoint = (uint16_t)(cpu.pc-1+length);
+            // Guard against stopping in a recursive call that reaches the same address
+            stepGuardStack = instr->isCall(op1, op2);
+            stepStackPointer = cpu.sp;
+            runUntilTrigger();
         }
         else if( mode == TAKE) {
-            uint16_t branchAddress = cpu.pc-1;
-            bool isTaken = false;
-            uint64_t tickCount = 0;
-            do {
-                if( z80_opdone(&cpu) && (cpu.pc-1 == branchAddress)) {
-                    isTaken = instr->isTaken(readMem(cpu.pc-1), readMem(cpu.pc), cpu.f);
-                }
-                tickCount = run(false, tickCount);
-            }
-            while( !z80_opdone(&cpu) || (!isTaken && mode == TAKE) );
-            mode = DEBUG;
+            takeBranchAddress = cpu.pc-1;
+            takeBranchTaken = instr->isTaken(readMem(cpu.pc-1), readMem(cpu.pc), cpu.f);
+            runUntilTrigger();
         }
 
         if( mode == DEBUG ) {
+            if( videoBeast ) {
+                videoBeast->catchUp(clock_time_ps);
+            }
+            // Listings re-assembled while running are swapped in before anything is drawn from them
+            listing.update();
             drawBeast();
             onDebug();
-            SDL_Event windowEvent;
+            SDL_Event windowEvent = {};
 
             while( SDL_PollEvent(&windowEvent ) == 0 ) {
                 SDL_Delay(25);
+                // Redraw until a terminal connects
                 if( !uart_connected(&uart) ) {
-                    uart_connect(&uart, true);
+                    break;
+                }
+                // Redraw with a listing that has been re-assembled
+                if( listing.update() ) {
                     break;
                 }
             }
@@ -435,7 +450,7 @@ void Beast::mainLoop() {
                         case SDLK_s    : mode = STEP;   break;
                         case SDLK_u    : mode = OUT;    break;
                         case SDLK_o    : mode = OVER;   break;
-                        case SDLK_d    : uart_connect(&uart, false); break;
+                        case SDLK_d    : uart_disconnect(&uart); break;
                         case SDLK_t    : 
                             if( instr->isConditional(readMem(cpu.pc-1), readMem(cpu.pc))) {
                                 mode = TAKE;
@@ -460,6 +475,88 @@ void Beast::mainLoop() {
     }
 }
 
+void Beast::runUntilTrigger() {
+    // Stepping waits on the result, not the clock, so run as fast as possible
+    pacing = false;
+    run(true, 0);
+    while( !z80_opdone(&cpu) ) {
+        run(false, 0);
+    }
+    pacing = true;
+    stepBreakpoint = NO_BREAKPOINT;
+    takeBranchAddress = NO_BREAKPOINT;
+    if( mode != QUIT ) {
+        mode = DEBUG;
+    }
+}
+
+// SP compared with its saved value, allowing for a stack at the top of memory wrapping round to 0x0000
+static inline int16_t stackDepthFrom(uint16_t sp, uint16_t savedSp) {
+    return (int16_t)(uint16_t)(sp - savedSp);
+}
+
+bool Beast::stepTriggered(uint16_t pc) {
+    switch( mode ) {
+        case OVER: 
+            return pc == stepBreakpoint && (!stepGuardStack || stackDepthFrom(cpu.sp, stepStackPointer) >= 0);
+        case OUT:
+            // A pop balancing an earlier push also raises SP, so only a return counts
+            if( stepReturning && stackDepthFrom(cpu.sp, stepStackPointer) > 0 ) {
+                return true;
+            }
+            stepReturning = instr->isReturn(readMem(pc), readMem(pc+1));
+            return false;
+        case TAKE:
+            if( takeBranchTaken ) {
+                return true;
+            }
+            if( pc == takeBranchAddress ) {
+                takeBranchTaken = instr->isTaken(readMem(pc), readMem(pc+1), cpu.f);
+            }
+            return false;
+        default:
+            return false;
+    }
+}
+
+// VideoBeast follows the PIO's daisy chain protocol: INT is held until acknowledged, the vector goes on the bus
+// with the acknowledge, and devices further down the chain are blocked until RETI. A request the CPU hasn't
+// taken yet is withdrawn if the program clears it first.
+uint64_t Beast::videoBeastInterrupt(uint64_t pins) {
+    bool active = videoBeast->interruptActive(clock_time_ps);
+
+    if( (pins & Z80_RETI) && (videoBeastIntState & INT_SERVICED) ) {
+        videoBeastIntState &= ~INT_SERVICED;
+        pins &= ~Z80_RETI;
+    }
+    if( (videoBeastIntState & (INT_NEEDED|INT_REQUESTED)) && !active ) {
+        bool pioRequest = ((pio.port[0].int_state | pio.port[1].int_state) & Z80PIO_INT_REQUESTED) != 0;
+        if( (videoBeastIntState & INT_REQUESTED) && !pioRequest ) {
+            pins &= ~Z80_INT;
+        }
+        videoBeastIntState = 0;
+    }
+    else if( videoBeastIntState == 0 && active ) {
+        videoBeastIntState = INT_NEEDED;
+    }
+
+    if( videoBeastIntState != 0 && (pins & Z80_IEIO) ) {
+        pins &= ~Z80_IEIO;
+        if( videoBeastIntState & INT_NEEDED ) {
+            videoBeastIntState = INT_REQUESTED;
+        }
+        if( (videoBeastIntState & INT_REQUESTED) && (pins & (Z80_IORQ|Z80_M1)) == (Z80_IORQ|Z80_M1) ) {
+            Z80_SET_DATA(pins, videoBeast->interruptVector());
+            videoBeastIntState = INT_SERVICED;
+            pins &= ~Z80_INT;
+        }
+    }
+    if( videoBeastIntState & INT_REQUESTED ) {
+        pins |= Z80_INT;
+    }
+    return pins;
+}
+
 void Beast::updateSelection(int direction, int maxSelection) {
     selection += direction;
     if( selection < 0 ) selection = maxSelection-1;
@@ -498,9 +595,8 @@ uint64_t Beast::run(bool run, uint64_t tickCount) {
         pins = (pins & ~Z80_INT) | ((pins & Z80PIO_INT) ? Z80_INT : 0);
 
         portB = Z80PIO_GET_PB(pins);
-        portB &= ~0x10; // Clear the UART int pin...
-
         uart_tick(&uart, clock_time_ps);
+        portB = (portB & ~0x10) | ((uart.pins & UART_INT) ? 0x10 : 0);   // UART interrupt, to the PIO
 
         if (pins & Z80_MREQ) {
             const uint16_t addr = Z80_GET_ADDR(pins);
@@ -543,6 +639,7 @@ uint64_t Beast::run(bool run, uint64_t tickCount) {
                 uint8_t data = Z80_GET_DATA(pins);
                 if( isRam ) {
                     ram[mappedAddr] = data;
+                    pageGeneration[0x20 | (mappedAddr >> 14)]++;
                 }
                 else if( videoBeast && isVb ) {
                     videoBeast->write(mappedAddr, data, clock_time_ps);
@@ -579,6 +676,7 @@ uint64_t Beast::run(bool run, uint64_t tickCount) {
                             break;
                         case 0xA0: 
                             rom[mappedAddr] = data;
+                            pageGeneration[mappedAddr >> 14]++;
                             romOperation = true;
                             romCompletePs = clock_time_ps + ROM_BYTE_WRITE_PS;
                             romSequence = 3;
@@ -605,6 +703,9 @@ uint64_t Beast::run(bool run, uint64_t tickCount) {
                                 for( int i=1<<19; i>0; ) {
                                     rom[--i] = 0xFF;
                                 }
+                                for( int i=0; i<0x20; i++ ) {
+                                    pageGeneration[i]++;
+                                }
                                 romOperation = true;
                                 romCompletePs = clock_time_ps + ROM_CHIP_ERASE_PS;
                                 romSequence  = 3;
@@ -615,6 +716,7 @@ uint64_t Beast::run(bool run, uint64_t tickCount) {
                                 for( int i=0; i< 0x1000; i++) {
                                     rom[sectorAddress+i] = 0xFF;
                                 }
+                                pageGeneration[sectorAddress >> 14]++;
                                 romOperation = true;
                                 romCompletePs = clock_time_ps + ROM_SECTOR_ERASE_PS;
                                 romSequence = 3;
@@ -662,12 +764,16 @@ uint64_t Beast::run(bool run, uint64_t tickCount) {
             }
         }
 
+        if( videoBeast ) {
+            pins = videoBeastInterrupt(pins);
+        }
+
         if( videoBeast && (nextVideoBeastTickPs <= clock_time_ps) ) {
             nextVideoBeastTickPs = videoBeast->tick(clock_time_ps);
         }
 
         uint64_t elapsed = SDL_GetTicks() - startTime;
-        if( elapsed < (clock_time_ps - startClockPs)/1000000000ULL ) {
+        if( pacing && elapsed < (clock_time_ps - startClockPs)/1000000000ULL ) {
             SDL_Delay(1);
         }
 
@@ -708,9 +814,12 @@ uint64_t Beast::run(bool run, uint64_t tickCount) {
             onDraw();
         }
         tickCount++;
-        if( (uint64_t)(cpu.pc-1) == breakpoint && z80_opdone(&cpu)) {
-            mode = DEBUG;
-            run = false;
+        if( z80_opdone(&cpu) ) {
+            uint16_t pc = cpu.pc-1;
+            if( pc == breakpoint || (mode != RUN && stepTriggered(pc)) ) {
+                mode = DEBUG;
+                run = false;
+            }
         }
     }
     while( run );
@@ -977,7 +1086,7 @@ void Beast::onDebug() {
     print(430, ROW19, textColor, "[A]ppend audio %s", audioFile?"ON":"OFF");
     print(430, ROW20, textColor, "File \"%s\"", audioFilename);
 
-    print(620, ROW19, textColor, "TTY :%d", uart_port(&uart));
+    print(620, ROW19, textColor, "TTY %s", uart_name(&uart));
     if( uart_connected(&uart)) {
         print(620, ROW20, textColor, "Connected [D]rop");
     }
@@ -985,9 +1094,19 @@ void Beast::onDebug() {
         print(620, ROW20, textColor, "Disconnected");
     }
 
-    int page = pagingEnabled ? memoryPage[((cpu.pc-1) >> 14) & 0x03] : 0;
+    int page = pageFor(cpu.pc-1);
     currentLoc = listing.getLocation(page << 16 | (cpu.pc-1));
 
+    // Only trust the listing if it matches the instruction about to run
+    verifyListing();
+    int length = 1;
+    instr->decode(cpu.pc-1, [this](uint16_t address) { return this->readMem(address); }, &length);
+    Listing::Range mismatch;
+    if( currentLoc.valid && listing.findMismatch(page, cpu.pc-1, std::max(length, 1), mismatch) ) {
+        currentLoc.valid = false;
+        print(COL1, ROW22-14, highColor, "Listing does not match memory at 0x%04X-0x%04X", mismatch.start, mismatch.end);
+    }
+
     if( currentLoc.valid ) {
         int startLine = currentLoc.lineNum - 4;
         if( startLine < 0 ) startLine = 0;
@@ -1105,7 +1224,8 @@ void Beast::drawListing(uint16_t address, SDL_Color textColor, SDL_Color highCol
             decodedAddresses.push_back(address);
         }
         std::string line = instr->decode(address, f, &length);
-        print(COL1, ROW22+(14*i), (address == cpu.pc-1) ? highColor: textColor, "%04X             %s", address, const_cast<char*>(line.c_str()));
+        std::string symbol = listing.symbolFor(pageFor(address), address);
+        print(COL1, ROW22+(14*i), (address == cpu.pc-1) ? highColor: textColor, "%04X %-16.16s %s", address, symbol.c_str(), const_cast<char*>(line.c_str()));
         address += length;
     }
 }
@@ -1152,6 +1272,17 @@ void Beast::displayMem(int x, int y, SDL_Color textColor, uint16_t markAddress,
         print(x, y+2+(14*row), textColor, buffer);
         address += 16;
     }
+
+    if( page < 0 ) {
+        std::string symbol = listing.symbolFor(pageFor(markAddress), markAddress);
+        if( symbol.length() > 0 ) {
+            print(x, y+2+(14*3), textColor, "%.40s", symbol.c_str());
+        }
+    }
+}
+
+int Beast::pageFor(uint16_t address) {
+    return pagingEnabled ? memoryPage[(address >> 14) & 0x03] : 0;
 }
 
 uint8_t Beast::readMem(uint16_t address) {
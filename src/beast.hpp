@@ -51,6 +51,10 @@ class Beast {
         ~Beast();
 
         void init(uint64_t targetSpeedHz, uint64_t breakpoint, int audioDevice, int volume, int sampleRate, VideoBeast *videoBeast);
+        // Move serial data a byte at a time at the given rate (or UART_FAST_MAX), instead of at the programmed Baud rate
+        void setFastSerial(uint64_t baud);
+        // Where serial data goes, instead of a network terminal on the default port. Beast takes ownership.
+        void setSerialBackend(SerialBackend *backend);
         void mainLoop();
         uint64_t run(bool run, uint64_t tickCount);
 
@@ -87,6 +91,8 @@ class Beast {
         z80_t    cpu;
         z80pio_t pio;
         uart_t     uart;
+        uint64_t   fastSerialBaud = UART_FAST_OFF;
+        SerialBackend *serialBackend = nullptr;
         Instructions *instr;
 
         I2c      *i2c;
@@ -96,6 +102,14 @@ class Beast {
 
         VideoBeast *videoBeast;
         uint64_t   nextVideoBeastTickPs;
+
+        // VideoBeast's place in the interrupt daisy chain, after the PIO
+        static const uint8_t INT_NEEDED    = 0x01;
+        static const uint8_t INT_REQUESTED = 0x02;
+        static const uint8_t INT_SERVICED  = 0x04;
+        uint8_t  videoBeastIntState = 0;
+
+        uint64_t videoBeastInterrupt(uint64_t pins);
         
         uint64_t pins;
         uint8_t portB;
@@ -105,9 +119,27 @@ class Beast {
         uint64_t breakpoint = 0xF20D;
         uint64_t lastBreakpoint = 0;
 
+        // Internal triggers for Step Over, Step Out and Until Taken, checked at instruction boundaries in run()
+        uint64_t stepBreakpoint = NO_BREAKPOINT;
+        uint16_t stepStackPointer = 0;
+        bool     stepGuardStack = false;    // Step Over a call only stops once SP is back to stepStackPointer
+        bool     stepReturning = false;     // The instruction being executed is a RET, RETI or RETN
+        uint64_t takeBranchAddress = NO_BREAKPOINT;
+        bool     takeBranchTaken = false;
+        bool     pacing = true;             // Held to real time. Off while running to a trigger.
+
+        void runUntilTrigger();
+        bool stepTriggered(uint16_t pc);
+
         uint8_t rom[(1<<19)]; // 512K rom
         uint8_t ram[(1<<19)]; // 512K ram
 
+        static const int MEMORY_PAGES = 64;
+        uint32_t pageGeneration[MEMORY_PAGES] = {0};   // Bumped on each write to a 16K physical page
+
+        const uint8_t *pageMemory(int page, uint32_t &generation);
+        void verifyListing();
+
         bool     romOperation = false;
         uint8_t  romSequence = 0;
         uint8_t  romOperationMask = 0x80;
@@ -119,6 +151,7 @@ class Beast {
 
         uint8_t memoryPage[4];
         bool    pagingEnabled = false;
+        int     pageFor(uint16_t address);
         uint8_t readMem(uint16_t address);
         uint8_t readPage(int page, uint16_t address);
 
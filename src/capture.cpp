@@ -0,0 +1,324 @@
+#include "capture.hpp"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <numeric>
+
+FrameCapture::FrameCapture() {
+    for( int i=0; i<POOL_FRAMES; i++ ) {
+        freeFrames.push_back(&pool[i]);
+    }
+}
+
+FrameCapture::~FrameCapture() {
+    if( writer.joinable() ) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        changed.notify_all();
+        writer.join();
+    }
+    if( stream ) {
+        fclose(stream);
+    }
+}
+
+bool FrameCapture::setImagePattern(const char *pattern) {
+    std::string name(pattern);
+    size_t dot = name.find_last_of('.');
+    std::string extension = (dot == std::string::npos) ? "" : name.substr(dot);
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+
+    if( extension == ".ppm" ) {
+        imageFormat = IMAGE_PPM;
+    }
+    else if( extension == ".png" ) {
+        imageFormat = IMAGE_PNG;
+    }
+    else {
+        return false;
+    }
+
+    // Exactly one conversion, for the frame number
+    size_t percent = name.find('%');
+    if( percent == std::string::npos || name.find('%', percent+1) != std::string::npos ) {
+        return false;
+    }
+    size_t conversion = name.find_first_not_of("0123456789", percent+1);
+    if( conversion == std::string::npos || name[conversion] != 'd' ) {
+        return false;
+    }
+    imagePattern = name;
+    return true;
+}
+
+void FrameCapture::setStream(const char *filename) {
+    streamName = filename;
+}
+
+bool FrameCapture::isActive() {
+    return imageFormat != IMAGE_NONE || !streamName.empty();
+}
+
+void FrameCapture::addFrame(const uint32_t *pixels, int stride, int width, int height, uint64_t frameNumber, uint64_t framePeriodPs) {
+    Frame *frame;
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        if( !writer.joinable() ) {
+            writer = std::thread(&FrameCapture::writerThread, this);
+        }
+        changed.wait(guard, [this] { return !freeFrames.empty(); });
+        frame = freeFrames.back();
+        freeFrames.pop_back();
+    }
+
+    frame->pixels.resize(width * height);
+    for( int y=0; y<height; y++ ) {
+        memcpy(frame->pixels.data() + y*width, pixels + y*stride, width * sizeof(uint32_t));
+    }
+    frame->width = width;
+    frame->height = height;
+    frame->frameNumber = frameNumber;
+    frame->framePeriodPs = framePeriodPs;
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        queued.push_back(frame);
+    }
+    changed.notify_all();
+}
+
+void FrameCapture::writerThread() {
+    while( true ) {
+        Frame *frame;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            changed.wait(guard, [this] { return stopping || !queued.empty(); });
+            if( queued.empty() ) {
+                break;
+            }
+            frame = queued.front();
+            queued.pop_front();
+        }
+
+        if( imageFormat != IMAGE_NONE ) {
+            writeImage(*frame);
+        }
+        if( !streamName.empty() ) {
+            writeStream(*frame);
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            freeFrames.push_back(frame);
+        }
+        changed.notify_all();
+    }
+}
+
+void FrameCapture::writeImage(const Frame &frame) {
+    char filename[1024];
+    snprintf(filename, sizeof(filename), imagePattern.c_str(), (int)frame.frameNumber);
+
+    FILE *file = fopen(filename, "wb");
+    if( file == nullptr ) {
+        std::cout << "Could not create capture file: " << filename << std::endl;
+        return;
+    }
+    bool written = (imageFormat == IMAGE_PNG) ? writePNG(file, frame) : writePPM(file, frame);
+    if( fclose(file) != 0 || !written ) {
+        std::cout << "Could not write capture file: " << filename << std::endl;
+    }
+}
+
+bool FrameCapture::writePPM(FILE *file, const Frame &frame) {
+    fprintf(file, "P6\n%d %d\n255\n", frame.width, frame.height);
+
+    std::vector<uint8_t> row(frame.width * 3);
+    for( int y=0; y<frame.height; y++ ) {
+        const uint32_t *pixels = frame.pixels.data() + y*frame.width;
+        for( int x=0; x<frame.width; x++ ) {
+            row[3*x]   = pixels[x] >> 16;
+            row[3*x+1] = pixels[x] >> 8;
+            row[3*x+2] = pixels[x];
+        }
+        if( fwrite(row.data(), 1, row.size(), file) != row.size() ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint32_t FrameCapture::crc32(uint32_t crc, const uint8_t *data, size_t length) {
+    static uint32_t table[256];
+    static bool built = false;
+    if( !built ) {
+        for( uint32_t n=0; n<256; n++ ) {
+            uint32_t c = n;
+            for( int k=0; k<8; k++ ) {
+                c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            }
+            table[n] = c;
+        }
+        built = true;
+    }
+    crc = ~crc;
+    for( size_t i=0; i<length; i++ ) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static void putBigEndian(uint8_t *p, uint32_t value) {
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+}
+
+void FrameCapture::writeChunk(FILE *file, const char *type, const uint8_t *data, uint32_t length) {
+    uint8_t header[8];
+    putBigEndian(header, length);
+    memcpy(header+4, type, 4);
+
+    uint8_t trailer[4];
+    putBigEndian(trailer, crc32(crc32(0, header+4, 4), data, length));
+
+    fwrite(header, 1, 8, file);
+    fwrite(data, 1, length, file);
+    fwrite(trailer, 1, 4, file);
+}
+
+// RGB PNG with the image data in stored (uncompressed) deflate blocks, which is quick to write and needs
+// no compression library
+bool FrameCapture::writePNG(FILE *file, const Frame &frame) {
+    static const uint8_t SIGNATURE[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    static const size_t MAX_STORED_BLOCK = 65535;
+
+    fwrite(SIGNATURE, 1, 8, file);
+
+    uint8_t header[13];
+    putBigEndian(header, frame.width);
+    putBigEndian(header+4, frame.height);
+    header[8] = 8;      // Bits per channel
+    header[9] = 2;      // RGB
+    header[10] = 0;     // Deflate
+    header[11] = 0;     // Adaptive filtering
+    header[12] = 0;     // Not interlaced
+    writeChunk(file, "IHDR", header, sizeof(header));
+
+    // Each row is a filter type byte (0, none) and then the pixels
+    std::vector<uint8_t> raw;
+    raw.reserve((1 + frame.width*3) * frame.height);
+    for( int y=0; y<frame.height; y++ ) {
+        const uint32_t *pixels = frame.pixels.data() + y*frame.width;
+        raw.push_back(0);
+        for( int x=0; x<frame.width; x++ ) {
+            raw.push_back(pixels[x] >> 16);
+            raw.push_back(pixels[x] >> 8);
+            raw.push_back(pixels[x]);
+        }
+    }
+
+    std::vector<uint8_t> zlib;
+    zlib.reserve(raw.size() + 5 * (raw.size() / MAX_STORED_BLOCK + 1) + 6);
+    zlib.push_back(0x78);
+    zlib.push_back(0x01);
+
+    uint32_t a = 1, b = 0;
+    for( size_t offset=0; offset<raw.size(); ) {
+        size_t length = std::min(MAX_STORED_BLOCK, raw.size() - offset);
+        bool last = offset + length == raw.size();
+
+        zlib.push_back(last ? 1 : 0);
+        zlib.push_back(length & 0xFF);
+        zlib.push_back(length >> 8);
+        zlib.push_back(~length & 0xFF);
+        zlib.push_back((~length >> 8) & 0xFF);
+        zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + length);
+
+        for( size_t i=offset; i<offset+length; i++ ) {
+            a = (a + raw[i]) % 65521;
+            b = (b + a) % 65521;
+        }
+        offset += length;
+    }
+    uint8_t adler[4];
+    putBigEndian(adler, (b << 16) | a);
+    zlib.insert(zlib.end(), adler, adler+4);
+
+    writeChunk(file, "IDAT", zlib.data(), zlib.size());
+    writeChunk(file, "IEND", nullptr, 0);
+
+    return ferror(file) == 0;
+}
+
+// 4:2:0 full range BT.601. The range is marked in the header, as YUV4MPEG2 otherwise implies limited range.
+void FrameCapture::writeStream(const Frame &frame) {
+    if( streamFailed ) {
+        return;
+    }
+    if( stream == nullptr ) {
+        // Opened here rather than at startup, as opening a named pipe waits for the reader
+        stream = fopen(streamName.c_str(), "wb");
+        if( stream == nullptr ) {
+            std::cout << "Could not open capture stream: " << streamName << std::endl;
+            streamFailed = true;
+            return;
+        }
+        streamWidth = frame.width;
+        streamHeight = frame.height;
+
+        uint64_t rate = 1000000000000ULL;
+        uint64_t divisor = std::gcd(rate, frame.framePeriodPs);
+        fprintf(stream, "YUV4MPEG2 W%d H%d F%llu:%llu Ip A1:1 C420jpeg XCOLORRANGE=FULL\n", streamWidth, streamHeight,
+                (unsigned long long)(rate / divisor), (unsigned long long)(frame.framePeriodPs / divisor));
+    }
+
+    // A stream can't change size part way through, so leave out frames from other video modes
+    if( frame.width != streamWidth || frame.height != streamHeight ) {
+        if( !reportedSize ) {
+            std::cout << "Capture stream is " << streamWidth << "x" << streamHeight << ", leaving out "
+                      << frame.width << "x" << frame.height << " frames" << std::endl;
+            reportedSize = true;
+        }
+        return;
+    }
+
+    int width = frame.width;
+    int height = frame.height;
+    std::vector<uint8_t> planes(width*height + 2 * (width/2) * (height/2));
+    uint8_t *luma = planes.data();
+    uint8_t *cb = luma + width*height;
+    uint8_t *cr = cb + (width/2) * (height/2);
+
+    for( int y=0; y<height; y++ ) {
+        const uint32_t *pixels = frame.pixels.data() + y*width;
+        for( int x=0; x<width; x++ ) {
+            int r = (pixels[x] >> 16) & 0xFF, g = (pixels[x] >> 8) & 0xFF, b = pixels[x] & 0xFF;
+            luma[y*width + x] = (19595*r + 38470*g + 7471*b + 32768) >> 16;
+        }
+    }
+    for( int y=0; y<height/2; y++ ) {
+        const uint32_t *top = frame.pixels.data() + 2*y*width;
+        const uint32_t *bottom = top + width;
+        for( int x=0; x<width/2; x++ ) {
+            int r = 0, g = 0, b = 0;
+            for( uint32_t pixel : {top[2*x], top[2*x+1], bottom[2*x], bottom[2*x+1]} ) {
+                r += (pixel >> 16) & 0xFF;
+                g += (pixel >> 8) & 0xFF;
+                b += pixel & 0xFF;
+            }
+            // Sums of four pixels, so scale by a quarter
+            cb[y*(width/2) + x] = std::clamp((-11059*r - 21709*g + 32768*b + (128 << 18) + (1 << 17)) >> 18, 0, 255);
+            cr[y*(width/2) + x] = std::clamp(( 32768*r - 27439*g -  5329*b + (128 << 18) + (1 << 17)) >> 18, 0, 255);
+        }
+    }
+
+    fputs("FRAME\n", stream);
+    if( fwrite(planes.data(), 1, planes.size(), stream) != planes.size() ) {
+        std::cout << "Could not write capture stream: " << streamName << std::endl;
+        streamFailed = true;
+    }
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Writes VideoBeast frames to numbered PPM or PNG images and/or a Y4M stream on a background thread.
+// Frames are copied into a small pool of buffers, so the renderer only waits if the writer falls a whole
+// pool behind. No frames are dropped, so captures can be compared between runs.
+class FrameCapture {
+
+    public:
+        FrameCapture();
+        ~FrameCapture();
+
+        // Numbered images from a printf style pattern for the frame number, e.g. "frame%05d.png". The
+        // format comes from the extension, .ppm or .png. Returns false if the pattern can't be used.
+        bool setImagePattern(const char *pattern);
+        // A Y4M stream to a file or named pipe, opened when the first frame arrives
+        void setStream(const char *filename);
+
+        bool isActive();
+
+        // Queue an ARGB frame. framePeriodPs sets the Y4M frame rate.
+        void addFrame(const uint32_t *pixels, int stride, int width, int height, uint64_t frameNumber, uint64_t framePeriodPs);
+
+    private:
+        static const int POOL_FRAMES = 8;
+
+        enum ImageFormat {IMAGE_NONE, IMAGE_PPM, IMAGE_PNG};
+
+        struct Frame {
+            std::vector<uint32_t> pixels;
+            int      width;
+            int      height;
+            uint64_t frameNumber;
+            uint64_t framePeriodPs;
+        };
+
+        ImageFormat imageFormat = IMAGE_NONE;
+        std::string imagePattern;
+        std::string streamName;
+
+        FILE *stream = nullptr;
+        bool  streamFailed = false;
+        int   streamWidth = 0;
+        int   streamHeight = 0;
+        bool  reportedSize = false;
+
+        Frame                   pool[POOL_FRAMES];
+        std::vector<Frame *>    freeFrames;
+        std::deque<Frame *>     queued;
+        std::mutex              lock;
+        std::condition_variable changed;
+        bool                    stopping = false;
+        std::thread             writer;
+
+        void writerThread();
+        void writeImage(const Frame &frame);
+        void writeStream(const Frame &frame);
+
+        static bool writePPM(FILE *file, const Frame &frame);
+        static bool writePNG(FILE *file, const Frame &frame);
+        static void writeChunk(FILE *file, const char *type, const uint8_t *data, uint32_t length);
+        static uint32_t crc32(uint32_t crc, const uint8_t *data, size_t length);
+};
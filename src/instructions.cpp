@@ -40,6 +40,39 @@ Instructions::Instructions() {
         }
     }
     myfile.close();
+
+    buildFlowTable();
+}
+
+void Instructions::buildFlowTable() {
+    for( int i=0; i<256; i++ ) {
+        flowIndex[i] = NO_FLOW;
+        edFlowIndex[i] = NO_FLOW;
+        ixyFlowIndex[i] = NO_FLOW;
+    }
+
+    int count = sizeof(FLOW_OPCODES)/sizeof(FLOW_OPCODES[0]);
+    for( int i=0; i<count; i++ ) {
+        const FlowOpcode &flow = FLOW_OPCODES[i];
+        switch( flow.prefix ) {
+            case 0x00: flowIndex[flow.opcode] = i; break;
+            case 0xED: edFlowIndex[flow.opcode] = i; break;
+            case 0xDD:
+            case 0xFD: ixyFlowIndex[flow.opcode] = i; break;
+        }
+    }
+}
+
+const Instructions::FlowOpcode *Instructions::flowFor(uint8_t op1, uint8_t op2) {
+    int8_t index;
+
+    switch( op1 ) {
+        case 0xED: index = edFlowIndex[op2]; break;
+        case 0xDD:
+        case 0xFD: index = ixyFlowIndex[op2]; break;
+        default:   index = flowIndex[op1];
+    }
+    return index == NO_FLOW ? nullptr : &FLOW_OPCODES[index];
 }
 
 void Instructions::parseOpcode(std::vector<std::string>parts, int column, uint8_t opcode, Opcode *opcodeArray) {
@@ -66,53 +99,29 @@ void Instructions::parseOpcode(std::vector<std::string>parts, int column, uint8_
     }
 }
 
-void Instructions::resetStack() {
-    stack = 0;
+bool Instructions::isJumpOrReturn(uint8_t op1, uint8_t op2) {
+    const FlowOpcode *flow = flowFor(op1, op2);
+    return flow && flow->dir <= 0 && flow->mask == 0;
 }
 
-bool Instructions::isOut(uint8_t op1, uint8_t op2) {
-    for( auto flow: FLOW_OPCODES ) {
-        if( (flow.prefix == 0x00 && flow.opcode == op1) ||
-            (flow.prefix != 0 && flow.prefix == op1 && flow.opcode == op2) ) {
-            stack += flow.dir;
-            break;
-        }
-    }
-
-    return stack < 0;
+bool Instructions::isConditional(uint8_t op1, uint8_t op2) {
+    const FlowOpcode *flow = flowFor(op1, op2);
+    return flow && flow->mask != 0;
 }
 
-bool Instructions::isJumpOrReturn(uint8_t op1, uint8_t op2) {
-    for( auto flow: FLOW_OPCODES ) {
-        if( (flow.prefix == 0x00 && flow.opcode == op1) ||
-            (flow.prefix != 0 && flow.prefix == op1 && flow.opcode == op2) ) {
-            return flow.dir <= 0 && flow.mask == 0;
-        }
-    }
-
-    return false;
+bool Instructions::isCall(uint8_t op1, uint8_t op2) {
+    const FlowOpcode *flow = flowFor(op1, op2);
+    return flow && flow->dir > 0;
 }
 
-bool Instructions::isConditional(uint8_t op1, uint8_t op2) {
-    for( auto flow: FLOW_OPCODES ) {
-        if( (flow.prefix == 0x00 && flow.opcode == op1) ||
-            (flow.prefix != 0 && flow.prefix == op1 && flow.opcode == op2) ) {
-            return flow.mask != 0;
-        }
-    }
-
-    return false;
+bool Instructions::isReturn(uint8_t op1, uint8_t op2) {
+    const FlowOpcode *flow = flowFor(op1, op2);
+    return flow && flow->dir < 0;
 }
 
 bool Instructions::isTaken(uint8_t op1, uint8_t op2, uint8_t flags) {
-    for( auto flow: FLOW_OPCODES ) {
-        if( (flow.prefix == 0x00 && flow.opcode == op1) ||
-            (flow.prefix != 0 && flow.prefix == op1 && flow.opcode == op2) ) {
-            return (flags & flow.mask) == flow.flags;
-        }
-    }
-
-    return false;
+    const FlowOpcode *flow = flowFor(op1, op2);
+    return flow && (flags & flow->mask) == flow->flags;
 }
 
 std::string Instructions::decodeOpcode(std::string mnemonic, uint16_t address, std::function<uint8_t(uint16_t)> fetch) {
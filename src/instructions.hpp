@@ -18,12 +18,12 @@ class Instructions {
 
     public:
         Instructions();
-        void resetStack();
-        bool isOut(uint8_t op1, uint8_t op2);
         bool isTaken(uint8_t op1, uint8_t op2, uint8_t flags);
         
         bool isJumpOrReturn(uint8_t op1, uint8_t op2);
         bool isConditional(uint8_t op1, uint8_t op2);
+        bool isCall(uint8_t op1, uint8_t op2);
+        bool isReturn(uint8_t op1, uint8_t op2);
 
         struct Opcode {
                 uint8_t opcode;
@@ -40,7 +40,15 @@ class Instructions {
  
     private:
         void parseOpcode(std::vector<std::string>parts, int column, uint8_t opcode, Opcode *opcodeArray);
-        int stack = 0;
+        void buildFlowTable();
+        const FlowOpcode *flowFor(uint8_t op1, uint8_t op2);
+
+        static const int8_t NO_FLOW = -1;
+
+        // Index into FLOW_OPCODES for each first opcode byte, and for the second byte after an ED or DD/FD prefix
+        int8_t flowIndex[256];
+        int8_t edFlowIndex[256];
+        int8_t ixyFlowIndex[256];
 
         const FlowOpcode FLOW_OPCODES[37] = {
         FlowOpcode {0x00, 0xCD, 0, 0, 1},   // Call
@@ -80,8 +88,8 @@ class Instructions {
         FlowOpcode {0x00, 0xF2, 0x80, 0x00, 0},   // JP - Sign pos
 
         FlowOpcode {0x00, 0xE9, 0, 0, 0},   // JP (HL)   
-        FlowOpcode {0xDD, 0xE9, 0, 0, -1},  // JP (IX)
-        FlowOpcode {0xFD, 0xE9, 0, 0, -1},  // JP (IY)
+        FlowOpcode {0xDD, 0xE9, 0, 0, 0},   // JP (IX)
+        FlowOpcode {0xFD, 0xE9, 0, 0, 0},   // JP (IY)
 
         FlowOpcode {0x00, 0x18, 0, 0, 0},  // JR
 
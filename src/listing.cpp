@@ -1,73 +1,494 @@
 #include "listing.hpp"
 #include <iostream>
-#include <iostream>
-#include <sstream>
 #include <fstream>
-#include <regex>
+#include <cstring>
+#include <cctype>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+static inline bool isBlank(char c) {
+    return c == ' ' || c == '\t';
+}
+
+static inline int hexDigit(char c) {
+    if( c >= '0' && c <= '9' ) return c - '0';
+    if( c >= 'a' && c <= 'f' ) return c - 'a' + 10;
+    if( c >= 'A' && c <= 'F' ) return c - 'A' + 10;
+    return -1;
+}
+
+static inline const char *skipBlanks(const char *p, const char *end) {
+    while( p < end && isBlank(*p) ) p++;
+    return p;
+}
+
+static inline const char *tokenEnd(const char *p, const char *end) {
+    while( p < end && !isBlank(*p) && *p != '\r' && *p != '\n' ) p++;
+    return p;
+}
+
+// Parse all characters between start and end as hex digits
+static bool parseHex(const char *start, const char *end, uint32_t &value) {
+    if( start >= end ) return false;
+
+    value = 0;
+    for( const char *p = start; p < end; p++ ) {
+        int digit = hexDigit(*p);
+        if( digit < 0 ) return false;
+        value = (value << 4) | digit;
+    }
+    return true;
+}
 
-static inline void ltrim(std::string &s) {
-    s.erase(s.begin(), std::find_if(s.begin(), s.end(), [](unsigned char ch) {
-        return !std::isspace(ch);
-    }));
+// Parse a number in any of the common assembler notations: $8000, #8000, 0x8000, 8000h or a plain
+// hex value starting with a decimal digit
+static bool parseNumber(const char *start, const char *end, uint32_t &value) {
+    if( start >= end ) return false;
+
+    if( *start == '$' || *start == '#' ) {
+        return parseHex(start+1, end, value);
+    }
+    if( end-start > 2 && start[0] == '0' && (start[1] == 'x' || start[1] == 'X') ) {
+        return parseHex(start+2, end, value);
+    }
+    if( !std::isdigit((unsigned char)*start) ) {
+        return false;
+    }
+    if( end[-1] == 'h' || end[-1] == 'H' ) {
+        return parseHex(start, end-1, value);
+    }
+    return parseHex(start, end, value);
+}
+
+static inline bool isLabelStart(char c) {
+    return std::isalpha((unsigned char)c) || c == '_' || c == '.' || c == '@';
+}
+
+static inline bool isLabelChar(char c) {
+    return std::isalnum((unsigned char)c) || c == '_' || c == '.' || c == '@' || c == '$' || c == '?';
+}
+
+static bool isEquate(const char *start, const char *end) {
+    static const char *EQUATES[] = {"EQU", ".EQU", "SET", ".SET", "DEFL", "DEFINE", ".DEFINE"};
+
+    if( start < end && *start == '=' ) {
+        return true;
+    }
+    size_t length = end-start;
+    for( const char *equate: EQUATES ) {
+        if( strlen(equate) == length && strncasecmp(equate, start, length) == 0 ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool isKeyword(const char *start, const char *end) {
+    static const char *KEYWORDS[] = {"EQU", "DEFL", "DEF", "SET", "ADDR"};
+
+    size_t length = end-start;
+    for( const char *keyword: KEYWORDS ) {
+        if( strlen(keyword) == length && strncasecmp(keyword, start, length) == 0 ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+Listing::ListingFile::ListingFile(const char *filename, int page) : filename(filename), page(page) {
+}
+
+bool Listing::ListingFile::load() {
+    // A copy rather than a mapping, as assemblers rewrite listings in place while they're being watched
+    std::ifstream ifs(filename, std::ios::binary|std::ios::ate);
+    if( !ifs ) {
+        return false;
+    }
+    data.resize(ifs.tellg());
+    ifs.seekg(0, std::ios::beg);
+    ifs.read(data.data(), data.size());
+    data.resize(ifs.gcount());      // Shorter if the file was cut down while being read
+
+    const char *start = data.data();
+    const char *end = start + data.size();
+    const char *p = start;
+    while( p < end ) {
+        lineStarts.push_back(p - start);
+        const char *eol = (const char *)memchr(p, '\n', end-p);
+        p = eol ? eol+1 : end;
+    }
+
+    size_t lineCount = lineStarts.size();
+    for( size_t lineNum = 1; lineNum <= lineCount; lineNum++ ) {
+        const char *line = start + lineStarts[lineNum-1];
+        const char *lineEnd = (lineNum < lineCount) ? start + lineStarts[lineNum] : end;
+
+        if( lineNum == 1 ) {
+            format = detectFormat(filename.c_str(), line, lineEnd);
+        }
+
+        LineInfo info = scanLine(format, line, lineEnd);
+        if( info.hasAddress || info.label ) {
+            entries.push_back(Entry{(int)lineNum, info});
+        }
+    }
+
+    if( format == FORMAT_Z88DK || format == FORMAT_ZMAC ) {
+        trimBytes();
+    }
+    return true;
+}
+
+// Without a fixed source column, source text that looks like hex can still follow the bytes. A line
+// can't hold more bytes than the gap up to the next address in the listing.
+void Listing::ListingFile::trimBytes() {
+    int following = -1;     // Address of the next line with one
+    int beyond = -1;        // The next address after that which differs from it
+
+    for( auto entry = entries.rbegin(); entry != entries.rend(); ++entry ) {
+        LineInfo &info = entry->info;
+        if( !info.hasAddress ) {
+            continue;
+        }
+        int nextAddress = (info.address == following) ? beyond : following;
+        if( info.byteCount > 0 && nextAddress > info.address ) {
+            info.byteCount = std::min(info.byteCount, nextAddress - info.address);
+        }
+        if( info.address != following ) {
+            beyond = following;
+            following = info.address;
+        }
+    }
+}
+
+Listing::Listing() : index(std::make_shared<Index>()) {
+    resetVerification();
+}
+
+Listing::~Listing() {
+    stopWatching = true;
+    if( watchThread.joinable() ) {
+        watchThread.join();
+    }
 }
 
 void Listing::addFile(const char *filename, int page) {
-    std::ifstream myfile(filename);
-    if(!myfile) {
+    auto file = std::make_shared<ListingFile>(filename, page);
+    if( !file->load() ) {
         std::cout << "Listing file does not exist: " << filename << std::endl;
         exit(1);
     }
-    std::string line;
-    std::vector<std::string> lines;
 
-    int fileNum = files.size();
+    std::vector<std::shared_ptr<const ListingFile>> files = index->files;
+    files.push_back(file);
+    index = buildIndex(files);
+    resetVerification();
+
+    std::cout << "Parsed listing, file "<< filename <<" for page " << page << " has " << file->lineStarts.size() << " lines." << std::endl;
+}
+
+// Build the index from files that have already been scanned, so only a changed file is re-parsed
+std::shared_ptr<Listing::Index> Listing::buildIndex(const std::vector<std::shared_ptr<const ListingFile>> &files) {
+    auto index = std::make_shared<Index>();
+    index->files = files;
+
+    for( size_t fileNum = 0; fileNum < files.size(); fileNum++ ) {
+        index->addFile(files[fileNum].get(), fileNum);
+    }
+    for( std::vector<Symbol> &symbols: index->pageSymbols ) {
+        std::stable_sort(symbols.begin(), symbols.end(), [](const Symbol &a, const Symbol &b) { return a.address < b.address; });
+    }
+    return index;
+}
+
+void Listing::Index::addFile(const ListingFile *file, int fileNum) {
+    int page = file->page;
 
     uint16_t address = 0;
     bool foundAddress = false;
-    int lineNum = 0;
     int addressLine = 0;
 
-    while (std::getline(myfile, line)) {
-        lineNum++;
-
-        lines.push_back(line);
+    // Symbol files only name addresses. Their lines aren't source to show for the code there.
+    bool hasSource = file->format != FORMAT_SYMBOLS;
 
-        ltrim(line);
-        std::regex matcher = std::regex(addressRegex, std::regex::icase);
-        std::smatch match;
-        if(std::regex_search(line, match, matcher)) {
-            uint16_t nextAddress = std::stoi(match.str(), nullptr, 16);
+    for( const ListingFile::Entry &entry: file->entries ) {
+        const LineInfo &info = entry.info;
 
-            if( foundAddress && (nextAddress != address) ) {
+        if( info.label ) {
+            addSymbol(page, info.address, info.label, info.labelLength);
+        }
+        if( info.byteCount > 0 ) {
+            addBytes(page, info.address, info.bytes, info.byteCount);
+        }
+        if( info.hasAddress && hasSource ) {
+            if( foundAddress && (info.address != address) ) {
                 Location loc = {fileNum, addressLine, true};
                 lineMap.emplace((page << 16) | address, loc);
             }
-            
+
             foundAddress = true;
-            address = nextAddress;
-            addressLine = lineNum;
-        }
-        else {
-            std::cout << "No match on line " << lineNum << std::endl;
+            address = info.address;
+            addressLine = entry.lineNum;
         }
     }
-    myfile.close();
-    
+
     if( foundAddress ) {
         Location loc = {fileNum, addressLine, true};
-        lineMap.emplace(address, loc);
+        lineMap.emplace((page << 16) | address, loc);
+    }
+}
+
+Listing::Format Listing::detectFormat(const char *filename, const char *line, const char *end) {
+    const char *extension = strrchr(filename, '.');
+    if( extension ) {
+        if( strcasecmp(extension, ".sym") == 0 || strcasecmp(extension, ".map") == 0 || strcasecmp(extension, ".noi") == 0 ) {
+            return FORMAT_SYMBOLS;
+        }
+        if( strcasecmp(extension, ".lis") == 0 ) {
+            return FORMAT_Z88DK;
+        }
+    }
+
+    if( end-line >= 13 && strncmp(line, "# file opened", 13) == 0 ) {
+        return FORMAT_SJASMPLUS;
+    }
+
+    // zmac numbers each line as 'NNN:'
+    const char *p = skipBlanks(line, end);
+    const char *token = tokenEnd(p, end);
+    if( token > p+1 && token[-1] == ':' ) {
+        uint32_t value;
+        if( parseHex(p, token-1, value) ) {
+            return FORMAT_ZMAC;
+        }
+    }
+    return FORMAT_TASM;
+}
+
+Listing::LineInfo Listing::scanLine(Format format, const char *line, const char *end) {
+    if( format == FORMAT_SYMBOLS ) {
+        return scanSymbolLine(line, end);
+    }
+    return scanListingLine(format, line, end);
+}
+
+// Listing lines start with a decimal line number (with an optional include marker), then a four digit
+// hex address. zmac may place a cycle count between the two.
+Listing::LineInfo Listing::scanListingLine(Format format, const char *line, const char *end) {
+    LineInfo info = {false, 0, nullptr, 0, {0}, 0};
+
+    const char *p = skipBlanks(line, end);
+    if( p == end || !std::isdigit((unsigned char)*p) ) {
+        return info;
+    }
+    while( p < end && std::isdigit((unsigned char)*p) ) p++;
+    while( p < end && (*p == '+' || *p == '~' || *p == ':') ) p++;
+    if( p < end && !isBlank(*p) ) {
+        return info;
+    }
+
+    int skip = (format == FORMAT_ZMAC) ? 1 : 0;
+    for( ;; ) {
+        p = skipBlanks(p, end);
+        const char *token = tokenEnd(p, end);
+        uint32_t value;
+
+        if( token-p == 4 && parseHex(p, token, value) ) {
+            info.hasAddress = true;
+            info.address = value;
+            const char *source = scanBytes(format, line, token, end, info);
+            scanLabel(format, line, source, end, info);
+            return info;
+        }
+        if( skip-- <= 0 || token == p ) {
+            return info;
+        }
+        p = token;
+    }
+}
+
+// The assembled bytes follow the address, either packed ('3E01') or separated by spaces ('3E 01'). In
+// fixed column formats they must end before the source text. Elsewhere the byte field ends at a tab or a
+// run of spaces, so source like 'defb' isn't read as bytes; load() also trims any bytes that run into the
+// next line's address. Returns the position after the last byte.
+const char *Listing::scanBytes(Format format, const char *line, const char *p, const char *end, LineInfo &info) {
+    bool fixedColumn = (format == FORMAT_TASM || format == FORMAT_SJASMPLUS);
+
+    for( ;; ) {
+        const char *token = skipBlanks(p, end);
+        const char *tokenStop = tokenEnd(token, end);
+
+        if( token == tokenStop || ((tokenStop-token) & 1) != 0 ) break;
+        if( fixedColumn && tokenStop-line > SOURCE_COLUMN ) break;
+        if( !fixedColumn && info.byteCount > 0 && (token-p != 1 || *p != ' ') ) break;
+
+        int count = (tokenStop-token) / 2;
+        if( info.byteCount + count > MAX_LINE_BYTES ) break;
+
+        bool isHex = true;
+        for( const char *c = token; c < tokenStop; c++ ) {
+            if( hexDigit(*c) < 0 ) {
+                isHex = false;
+                break;
+            }
+        }
+        if( !isHex ) break;
+
+        for( const char *c = token; c < tokenStop; c += 2 ) {
+            info.bytes[info.byteCount++] = (hexDigit(c[0]) << 4) | hexDigit(c[1]);
+        }
+        p = tokenStop;
+    }
+    return p;
+}
+
+// TASM and sjasmplus copy the source text from a fixed column, so any name starting in that column is
+// a label. Other formats only mark labels that are followed by ':'. Equates are skipped, since they
+// don't label the address of the line.
+void Listing::scanLabel(Format format, const char *line, const char *source, const char *end, LineInfo &info) {
+    bool fixedColumn = (format == FORMAT_TASM || format == FORMAT_SJASMPLUS);
+    const char *label;
+
+    if( fixedColumn ) {
+        if( end-line <= SOURCE_COLUMN || !isBlank(line[SOURCE_COLUMN-1]) ) {
+            return;
+        }
+        label = line + SOURCE_COLUMN;
+    }
+    else {
+        label = skipBlanks(source, end);
+    }
+
+    if( label >= end || !isLabelStart(*label) ) {
+        return;
+    }
+
+    const char *p = label;
+    while( p < end && isLabelChar(*p) ) p++;
+
+    bool colon = p < end && *p == ':';
+    if( !colon && (!fixedColumn || *label == '.') ) {
+        return;
     }
-    std::cout << "Parsed listing, file "<< filename <<" for page " << page << " has " << lineNum << " lines." << std::endl;
-    files.push_back(lines);
+
+    const char *next = skipBlanks(colon ? p+1 : p, end);
+    if( isEquate(next, tokenEnd(next, end)) ) {
+        return;
+    }
+
+    info.label = label;
+    info.labelLength = p-label;
+}
+
+// Symbol lines pair a label with a value, in forms like 'label: EQU 0x8000', 'label = $8000 ; ...',
+// 'DEF label 0x8000' or '8000 label'.
+Listing::LineInfo Listing::scanSymbolLine(const char *line, const char *end) {
+    LineInfo info = {false, 0, nullptr, 0, {0}, 0};
+
+    bool hasLabel = false;
+    bool hasValue = false;
+
+    const char *p = line;
+    while( p < end && !(hasLabel && hasValue) ) {
+        while( p < end && (isBlank(*p) || *p == ':' || *p == '=' || *p == ',') ) p++;
+        if( p == end || *p == ';' || *p == '\r' || *p == '\n' ) {
+            break;
+        }
+        const char *token = p;
+        while( p < end && !isBlank(*p) && *p != ':' && *p != '=' && *p != ',' && *p != ';' && *p != '\r' && *p != '\n' ) p++;
+
+        uint32_t value;
+        if( isKeyword(token, p) ) {
+            continue;
+        }
+        if( !hasValue && parseNumber(token, p, value) ) {
+            hasValue = true;
+            info.address = value;
+        }
+        else if( !hasLabel && isLabelStart(*token) ) {
+            hasLabel = true;
+            info.label = token;
+            info.labelLength = p-token;
+        }
+    }
+
+    info.hasAddress = hasLabel && hasValue;
+    if( !info.hasAddress ) {
+        info.label = nullptr;
+    }
+    return info;
+}
+
+void Listing::Index::addSymbol(int page, uint16_t address, const char *label, int length) {
+    std::string name(label, length);
+
+    symbolAddresses.emplace(name, (page << 16) | address);
+    pageSymbols[page & (PAGES-1)].push_back(Symbol{address, (uint32_t)symbolNames.size()});
+    symbolNames.push_back(name);
+}
+
+bool Listing::findSymbol(int page, uint16_t address, std::string &name, uint16_t &offset) {
+    const std::vector<Symbol> &symbols = index->pageSymbols[page & (PAGES-1)];
+
+    auto it = std::upper_bound(symbols.begin(), symbols.end(), address, [](uint16_t value, const Symbol &symbol) { return value < symbol.address; });
+    if( it == symbols.begin() ) {
+        return false;
+    }
+    --it;
+
+    uint16_t found = it->address;
+    if( address - found > MAX_SYMBOL_OFFSET ) {
+        return false;
+    }
+    // Prefer the first label defined at that address
+    while( it != symbols.begin() && (it-1)->address == found ) {
+        --it;
+    }
+
+    name = index->symbolNames[it->nameIndex];
+    offset = address - found;
+    return true;
+}
+
+bool Listing::lookupSymbol(const std::string &name, uint32_t &address) {
+    auto search = index->symbolAddresses.find(name);
+    if( search != index->symbolAddresses.end() ) {
+        address = search->second;
+        return true;
+    }
+    return false;
+}
+
+std::string Listing::symbolFor(int page, uint16_t address) {
+    std::string name;
+    uint16_t offset;
+
+    if( !findSymbol(page, address, name, offset) ) {
+        return "";
+    }
+    if( offset > 0 ) {
+        name += "+" + std::to_string(offset);
+    }
+    return name;
 }
 
 int Listing::fileCount() {
-    return files.size();
+    return index->files.size();
 }
 
 Listing::Location Listing::getLocation(uint32_t address) {
-    auto search = lineMap.find(address);
-    if (search != lineMap.end()) {
+    auto search = index->lineMap.find(address);
+    if (search != index->lineMap.end()) {
         return search->second;
     }
 
@@ -75,8 +496,230 @@ Listing::Location Listing::getLocation(uint32_t address) {
 }
 
 std::string Listing::getLine(Location location) {
-    if( location.valid ) {
-        return files[location.fileNum][location.lineNum];
+    if( !location.valid || location.fileNum < 0 || location.fileNum >= (int)index->files.size() ) {
+        return "";
+    }
+
+    const ListingFile *file = index->files[location.fileNum].get();
+    if( location.lineNum < 0 || location.lineNum >= (int)file->lineStarts.size() ) {
+        return "";
+    }
+
+    const char *text = file->data.data();
+    const char *start = text + file->lineStarts[location.lineNum];
+    const char *end = (location.lineNum+1 < (int)file->lineStarts.size()) ? text + file->lineStarts[location.lineNum+1] : text + file->data.size();
+
+    while( end > start && (end[-1] == '\n' || end[-1] == '\r') ) end--;
+    return std::string(start, end-start);
+}
+
+void Listing::Index::addBytes(int page, uint16_t address, const uint8_t *bytes, int count) {
+    std::vector<ByteRun> &runs = pageRuns[page & (PAGES-1)];
+    std::vector<uint8_t> &data = pageBytes[page & (PAGES-1)];
+
+    if( runs.size() > 0 && (uint16_t)(runs.back().address + runs.back().length) == address ) {
+        runs.back().length += count;
+    }
+    else {
+        runs.push_back(ByteRun{address, (uint32_t)data.size(), (uint32_t)count});
+    }
+    data.insert(data.end(), bytes, bytes+count);
+}
+
+static void addMismatch(std::vector<Listing::Range> &mismatches, uint16_t address) {
+    if( mismatches.size() > 0 && (uint16_t)(mismatches.back().end+1) == address ) {
+        mismatches.back().end = address;
+    }
+    else {
+        mismatches.push_back(Listing::Range{address, address});
+    }
+}
+
+// Record every byte that differs between the listing and memory, comparing 16 bytes at a time where
+// SSE2 is available
+static void compareBytes(const uint8_t *expected, const uint8_t *actual, int length, uint16_t address, std::vector<Listing::Range> &mismatches) {
+    int i = 0;
+#if defined(__SSE2__)
+    for( ; i+16 <= length; i += 16 ) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(expected+i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(actual+i));
+        if( _mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) != 0xFFFF ) {
+            for( int j=i; j<i+16; j++ ) {
+                if( expected[j] != actual[j] ) addMismatch(mismatches, address+j);
+            }
+        }
+    }
+#endif
+    for( ; i<length; i++ ) {
+        if( expected[i] != actual[i] ) addMismatch(mismatches, address+i);
+    }
+}
+
+void Listing::verify(std::function<const uint8_t *(int page, uint32_t &generation)> pageMemory) {
+    for( int page=0; page<PAGES; page++ ) {
+        if( index->pageRuns[page].size() == 0 ) continue;
+
+        uint32_t generation = 0;
+        const uint8_t *memory = pageMemory(page, generation);
+        if( !memory || generation == verifiedGeneration[page] ) continue;
+
+        bool firstCheck = verifiedGeneration[page] == UNVERIFIED;
+        verifiedGeneration[page] = generation;
+
+        std::vector<Range> &mismatches = pageMismatches[page];
+        mismatches.clear();
+
+        const uint8_t *expected = index->pageBytes[page].data();
+        for( const ByteRun &run: index->pageRuns[page] ) {
+            // The listing is pinned to this page, so split runs where they wrap across a 16K boundary
+            uint32_t done = 0;
+            while( done < run.length ) {
+                uint16_t address = run.address + done;
+                uint32_t offset = address & 0x3FFF;
+                uint32_t length = std::min(run.length - done, 0x4000 - offset);
+
+                compareBytes(expected + run.offset + done, memory + offset, length, address, mismatches);
+                done += length;
+            }
+        }
+        std::sort(mismatches.begin(), mismatches.end(), [](const Range &a, const Range &b) { return a.start < b.start; });
+
+        if( firstCheck && mismatches.size() > 0 ) {
+            std::cout << "WARNING: Listing for page 0x" << std::hex << page << " does not match memory at " << std::dec << mismatches.size() 
+                      << " range(s), starting at 0x" << std::hex << mismatches[0].start << std::dec << std::endl;
+        }
+    }
+}
+
+bool Listing::findMismatch(int page, uint16_t address, int length, Range &range) {
+    const std::vector<Range> &mismatches = pageMismatches[page & (PAGES-1)];
+
+    // First range that ends at or after the address
+    auto it = std::lower_bound(mismatches.begin(), mismatches.end(), address, [](const Range &range, uint16_t value) { return range.end < value; });
+    if( it != mismatches.end() && it->start < address+length ) {
+        range = *it;
+        return true;
+    }
+    return false;
+}
+
+void Listing::resetVerification() {
+    for( int page=0; page<PAGES; page++ ) {
+        verifiedGeneration[page] = UNVERIFIED;
+        pageMismatches[page].clear();
+    }
+}
+
+bool Listing::update() {
+    if( !pendingReady ) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(pendingLock);
+    index = pending;
+    pending.reset();
+    pendingReady = false;
+    resetVerification();
+    return true;
+}
+
+void Listing::watch() {
+    if( index->files.size() == 0 || watchThread.joinable() ) {
+        return;
+    }
+    watchThread = std::thread(&Listing::watchFiles, this, index->files);
+}
+
+// Runs on the watch thread, with its own copy of the file list
+void Listing::watchFiles(std::vector<std::shared_ptr<const ListingFile>> files) {
+#ifdef __linux__
+    int fd = inotify_init1(IN_NONBLOCK);
+    if( fd < 0 ) {
+        std::cout << "Unable to watch listing files for changes" << std::endl;
+        return;
+    }
+
+    // Watch the directories, as assemblers and editors often replace a file rather than rewrite it
+    std::vector<int> watches;
+    std::vector<std::string> names;
+    for( auto &file: files ) {
+        std::filesystem::path path(file->filename);
+        std::string directory = path.has_parent_path() ? path.parent_path().string() : ".";
+
+        watches.push_back(inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO));
+        names.push_back(path.filename().string());
+    }
+
+    alignas(struct inotify_event) char buffer[4096];
+    while( !stopWatching ) {
+        struct pollfd events = {fd, POLLIN, 0};
+        if( poll(&events, 1, WATCH_INTERVAL_MS) <= 0 ) {
+            continue;
+        }
+
+        std::vector<bool> changed(files.size(), false);
+        ssize_t length;
+        while( (length = read(fd, buffer, sizeof(buffer))) > 0 ) {
+            for( char *p = buffer; p < buffer+length; ) {
+                const struct inotify_event *event = (const struct inotify_event *)p;
+                for( size_t i=0; i<files.size(); i++ ) {
+                    if( event->len > 0 && event->wd == watches[i] && names[i] == event->name ) {
+                        changed[i] = true;
+                    }
+                }
+                p += sizeof(struct inotify_event) + event->len;
+            }
+        }
+        reloadFiles(files, changed);
+    }
+    close(fd);
+#else
+    // No inotify, so poll the modification times instead
+    std::vector<std::filesystem::file_time_type> times;
+    for( auto &file: files ) {
+        std::error_code error;
+        times.push_back(std::filesystem::last_write_time(file->filename, error));
+    }
+
+    while( !stopWatching ) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(WATCH_INTERVAL_MS));
+
+        std::vector<bool> changed(files.size(), false);
+        for( size_t i=0; i<files.size(); i++ ) {
+            std::error_code error;
+            auto time = std::filesystem::last_write_time(files[i]->filename, error);
+            if( !error && time != times[i] ) {
+                times[i] = time;
+                changed[i] = true;
+            }
+        }
+        reloadFiles(files, changed);
+    }
+#endif
+}
+
+// Re-parse the changed files and hand a new index over to update(). Unchanged files are shared with the
+// current index rather than scanned again.
+void Listing::reloadFiles(std::vector<std::shared_ptr<const ListingFile>> &files, const std::vector<bool> &changed) {
+    bool reloaded = false;
+
+    for( size_t i=0; i<files.size(); i++ ) {
+        if( !changed[i] ) continue;
+
+        auto file = std::make_shared<ListingFile>(files[i]->filename.c_str(), files[i]->page);
+        if( !file->load() ) {
+            std::cout << "Unable to reload listing " << files[i]->filename << std::endl;
+            continue;
+        }
+        std::cout << "Reloaded listing, file " << file->filename << " for page " << file->page << " has " << file->lineStarts.size() << " lines." << std::endl;
+        files[i] = file;
+        reloaded = true;
+    }
+
+    if( reloaded ) {
+        std::shared_ptr<Index> next = buildIndex(files);
+
+        std::lock_guard<std::mutex> lock(pendingLock);
+        pending = next;
+        pendingReady = true;
     }
-    return "";
 }
@@ -1,8 +1,14 @@
 #pragma once
+#include <atomic>
 #include <cstdint>
+#include <functional>
 #include <iostream>
 #include <string>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 class Listing {
@@ -14,18 +20,143 @@ class Listing {
             bool valid;
         };
 
+        enum Format {FORMAT_TASM, FORMAT_SJASMPLUS, FORMAT_Z88DK, FORMAT_ZMAC, FORMAT_SYMBOLS};
+
+        Listing();
+        ~Listing();
+
         void addFile(const char* filename, int page);
         int fileCount();
-        
+
+        // Watch the listing files and re-parse any that change on a background thread
+        void watch();
+        // Swap in a re-parsed index, if one is ready. Returns true if the listing changed.
+        bool update();
+
         Location getLocation(uint32_t address);
         std::string getLine(Location location);
 
+        // Nearest label at or below the address in the given page, within MAX_SYMBOL_OFFSET bytes
+        bool findSymbol(int page, uint16_t address, std::string &name, uint16_t &offset);
+        // Address of a label as (page << 16) | address
+        bool lookupSymbol(const std::string &name, uint32_t &address);
+        // 'label' or 'label+offset' for reports, or an empty string if there is no nearby label
+        std::string symbolFor(int page, uint16_t address);
+
+        static const int MAX_SYMBOL_OFFSET = 0x100;
+
+        struct Range {
+            uint16_t start;
+            uint16_t end;       // Inclusive
+        };
+
+        // Compare assembled bytes with memory, for each page whose write generation has changed. pageMemory
+        // returns the 16K physical page (or nullptr if it isn't memory) and its current write generation.
+        void verify(std::function<const uint8_t *(int page, uint32_t &generation)> pageMemory);
+        // Find a range of bytes that don't match memory, overlapping length bytes from the address
+        bool findMismatch(int page, uint16_t address, int length, Range &range);
+
     private:
-        std::vector<std::vector<std::string>> files;
+        static const int SOURCE_COLUMN  = 24;
+        static const int MAX_LINE_BYTES = 16;
+
+        // The fields recognised at the start of a single listing line
+        struct LineInfo {
+            bool        hasAddress;
+            uint16_t    address;
+            const char *label;
+            int         labelLength;
+            uint8_t     bytes[MAX_LINE_BYTES];
+            int         byteCount;
+        };
+
+        // A listing file read into memory, with the offset of the start of each line and the fields
+        // scanned from each line that has an address or label
+        struct ListingFile {
+            ListingFile(const char *filename, int page);
+            // Scanned labels point into data, so a copy would refer to the original's text
+            ListingFile(const ListingFile &) = delete;
+            ListingFile &operator=(const ListingFile &) = delete;
+
+            // Read and scan the file, returning false if it can't be read
+            bool load();
+            void trimBytes();
+
+            struct Entry {
+                int      lineNum;
+                LineInfo info;
+            };
+
+            std::string filename;
+            int         page;
+            Format      format = FORMAT_TASM;
+
+            std::vector<char> data;
+
+            std::vector<uint32_t> lineStarts;
+            std::vector<Entry>    entries;
+        };
+
+        // Contiguous assembled bytes from a listing, stored in pageBytes from offset
+        struct ByteRun {
+            uint16_t address;
+            uint32_t offset;
+            uint32_t length;
+        };
+
+        struct Symbol {
+            uint16_t address;
+            uint32_t nameIndex;
+        };
+
+        static const int PAGES = 256;
+
+        // Everything looked up from the listing files. An index is never changed once built, so a reload
+        // builds a new one on the watch thread and update() swaps it in.
+        struct Index {
+            std::vector<std::shared_ptr<const ListingFile>> files;
+
+            std::map<int, Location> lineMap;
+
+            std::vector<std::string> symbolNames;
+            std::vector<Symbol>      pageSymbols[PAGES];                   // Sorted by address
+            std::unordered_map<std::string, uint32_t> symbolAddresses;    // Label -> (page << 16) | address
+
+            std::vector<uint8_t> pageBytes[PAGES];
+            std::vector<ByteRun> pageRuns[PAGES];
+
+            void addFile(const ListingFile *file, int fileNum);
+            void addSymbol(int page, uint16_t address, const char *label, int length);
+            void addBytes(int page, uint16_t address, const uint8_t *bytes, int count);
+        };
+
+        std::shared_ptr<Index> index;
+
+        static std::shared_ptr<Index> buildIndex(const std::vector<std::shared_ptr<const ListingFile>> &files);
+
+        static const uint32_t UNVERIFIED = 0xFFFFFFFF;
+
+        std::vector<Range>   pageMismatches[PAGES];                    // Sorted by start address
+        uint32_t             verifiedGeneration[PAGES];
+
+        void resetVerification();
+
+        std::thread             watchThread;
+        std::atomic<bool>       stopWatching{false};
+        std::atomic<bool>       pendingReady{false};
+        std::mutex              pendingLock;
+        std::shared_ptr<Index>  pending;
 
-        std::map<int, Location> lineMap;
+        static const int WATCH_INTERVAL_MS = 250;
 
-        const char* addressRegex = "\\s([0-9a-f]+)";
+        void watchFiles(std::vector<std::shared_ptr<const ListingFile>> files);
+        void reloadFiles(std::vector<std::shared_ptr<const ListingFile>> &files, const std::vector<bool> &changed);
 
+        static Format   detectFormat(const char *filename, const char *line, const char *end);
+        static LineInfo scanLine(Format format, const char *line, const char *end);
+        static LineInfo scanListingLine(Format format, const char *line, const char *end);
+        static LineInfo scanSymbolLine(const char *line, const char *end);
+        static const char *scanBytes(Format format, const char *line, const char *p, const char *end, LineInfo &info);
+        static void     scanLabel(Format format, const char *line, const char *source, const char *end, LineInfo &info);
 };
 
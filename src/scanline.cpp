@@ -0,0 +1,86 @@
+#include "scanline.hpp"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SCANLINE_AVX2
+#include <immintrin.h>
+#endif
+
+Scanline::ResolveSpan Scanline::resolveSpan = nullptr;
+const char *Scanline::kernelName = "";
+
+uint32_t Scanline::OPAQUE[256];
+uint64_t Scanline::GLYPH_MASK[256];
+uint8_t  Scanline::NIBBLES[256][2];
+
+static void resolveSpanScalar(uint32_t *dest, const uint8_t *indices, int count, const uint32_t *palette, const uint32_t *mask) {
+    for( int i=0; i<count; i++ ) {
+        if( mask[indices[i]] ) {
+            dest[i] = palette[indices[i]];
+        }
+    }
+}
+
+#if defined(__SSE2__)
+// SSE2 has no gather, so the lookups stay scalar but the blend and store are done 4 pixels at a time
+static void resolveSpanSSE2(uint32_t *dest, const uint8_t *indices, int count, const uint32_t *palette, const uint32_t *mask) {
+    int i = 0;
+    for( ; i+4 <= count; i += 4 ) {
+        const uint8_t *idx = indices + i;
+        __m128i colour = _mm_setr_epi32(palette[idx[0]], palette[idx[1]], palette[idx[2]], palette[idx[3]]);
+        __m128i write  = _mm_setr_epi32(mask[idx[0]], mask[idx[1]], mask[idx[2]], mask[idx[3]]);
+        __m128i old    = _mm_loadu_si128((const __m128i *)(dest+i));
+
+        _mm_storeu_si128((__m128i *)(dest+i), _mm_or_si128(_mm_and_si128(write, colour), _mm_andnot_si128(write, old)));
+    }
+    resolveSpanScalar(dest+i, indices+i, count-i, palette, mask);
+}
+#endif
+
+#ifdef SCANLINE_AVX2
+__attribute__((target("avx2")))
+static void resolveSpanAVX2(uint32_t *dest, const uint8_t *indices, int count, const uint32_t *palette, const uint32_t *mask) {
+    int i = 0;
+    for( ; i+8 <= count; i += 8 ) {
+        __m256i idx    = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(indices+i)));
+        __m256i colour = _mm256_i32gather_epi32((const int *)palette, idx, 4);
+        __m256i write  = _mm256_i32gather_epi32((const int *)mask, idx, 4);
+        __m256i old    = _mm256_loadu_si256((const __m256i *)(dest+i));
+
+        _mm256_storeu_si256((__m256i *)(dest+i), _mm256_blendv_epi8(old, colour, write));
+    }
+    resolveSpanScalar(dest+i, indices+i, count-i, palette, mask);
+}
+#endif
+
+void Scanline::init() {
+    for( int value=0; value<256; value++ ) {
+        OPAQUE[value] = 0xFFFFFFFF;
+
+        uint8_t mask[8];
+        for( int bit=0; bit<8; bit++ ) {
+            mask[bit] = (value & (0x80 >> bit)) ? 0xFF : 0x00;
+        }
+        memcpy(&GLYPH_MASK[value], mask, 8);
+
+        NIBBLES[value][0] = value >> 4;
+        NIBBLES[value][1] = value & 0x0F;
+    }
+
+    resolveSpan = resolveSpanScalar;
+    kernelName = "scalar";
+#if defined(__SSE2__)
+    resolveSpan = resolveSpanSSE2;
+    kernelName = "SSE2";
+#endif
+#ifdef SCANLINE_AVX2
+    __builtin_cpu_init();
+    if( __builtin_cpu_supports("avx2") ) {
+        resolveSpan = resolveSpanAVX2;
+        kernelName = "AVX2";
+    }
+#endif
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+
+// Scanline kernels for VideoBeast. Layers first expand their pixels into a span of palette indices, 8 at a
+// time through lookup tables, then resolve the span into colours with the widest kernel the host supports.
+class Scanline {
+
+    public:
+        // Write palette[index] for each index whose mask entry is set. Transparent entries have a mask of 0
+        // and leave the pixel underneath in place.
+        typedef void (*ResolveSpan)(uint32_t *dest, const uint8_t *indices, int count, const uint32_t *palette, const uint32_t *mask);
+
+        // Build the tables and choose the kernel for this CPU
+        static void init();
+
+        static ResolveSpan resolveSpan;
+        static const char *kernelName;
+
+        // Mask for palettes without transparency
+        static uint32_t OPAQUE[256];
+
+        // Bytes of 0xFF for each set bit in a glyph row, leftmost pixel (bit 7) first
+        static inline uint64_t glyphMask(uint8_t pixels) {
+            return GLYPH_MASK[pixels];
+        }
+
+        // Eight 4 bit pixels from four bytes as one byte each, high nibble first
+        static inline uint64_t expandNibbles(const uint8_t *bytes) {
+            uint8_t expanded[8];
+            for( int i=0; i<4; i++ ) {
+                memcpy(expanded + 2*i, NIBBLES[bytes[i]], 2);
+            }
+            uint64_t span;
+            memcpy(&span, expanded, 8);
+            return span;
+        }
+
+        // The same byte in every lane of a span
+        static inline uint64_t repeat(uint8_t value) {
+            return value * 0x0101010101010101ULL;
+        }
+
+    private:
+        static uint64_t GLYPH_MASK[256];
+        static uint8_t  NIBBLES[256][2];
+};
@@ -0,0 +1,424 @@
+#include "serial.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+#endif
+
+SerialBackend *SerialBackend::create(const std::string &description) {
+    size_t colon = description.find(':');
+    std::string kind = description.substr(0, colon);
+    std::string argument = (colon == std::string::npos) ? "" : description.substr(colon+1);
+
+    if( kind == "tcp" ) {
+        int port = TcpSerial::DEFAULT_PORT;
+        if( colon != std::string::npos ) {
+            if( argument.empty() || argument.size() > 5 || argument.find_first_not_of("0123456789") != std::string::npos ||
+                (port = std::stoi(argument)) == 0 || port > 65535 ) {
+                std::cout << "Serial: expected a port number, not '" << argument << "'" << std::endl;
+                return nullptr;
+            }
+        }
+        return new TcpSerial(port);
+    }
+    if( kind == "file" && !argument.empty() ) {
+        uint32_t rate = 0;
+        size_t comma = argument.find_last_of(',');
+        if( comma != std::string::npos ) {
+            std::string rateText = argument.substr(comma+1);
+            if( rateText.empty() || rateText.size() > 9 || rateText.find_first_not_of("0123456789") != std::string::npos ) {
+                std::cout << "Serial: expected a rate in bytes per second, not '" << rateText << "'" << std::endl;
+                return nullptr;
+            }
+            rate = std::stoul(rateText);
+            argument = argument.substr(0, comma);
+        }
+        return ReplaySerial::open(argument, rate);
+    }
+#ifndef _WIN32
+    if( kind == "pty" ) {
+        return PtySerial::open(argument.empty() ? PtySerial::DEFAULT_PATH : argument);
+    }
+    if( kind == "stdio" && colon == std::string::npos ) {
+        return new StdioSerial();
+    }
+#else
+    if( kind == "pty" || kind == "stdio" ) {
+        std::cout << "Serial: " << kind << " is not available on Windows" << std::endl;
+        return nullptr;
+    }
+#endif
+    std::cout << "Serial: expected tcp[:port], pty[:path], stdio or file:filename[,rate], not '" << description << "'" << std::endl;
+    return nullptr;
+}
+
+//-- TCP -----------------------------------------------------------------------
+
+TcpSerial::TcpSerial(int port) : port(port) {
+    snprintf(label, sizeof(label), ":%d", port);
+
+    IPaddress ip;
+
+    if (SDLNet_ResolveHost(&ip, NULL, port) == -1) {
+        std::cout << "SDLNet_ResolveHost error: " << SDLNet_GetError() << std::endl;
+        return;
+    }
+
+    server = SDLNet_TCP_Open(&ip);
+    if (!server) {
+        std::cout << "SDLNet_TCP_Open error: " << SDLNet_GetError() << std::endl;
+        return;
+    }
+
+    socketSet = SDLNet_AllocSocketSet(1);
+    if( !socketSet ) {
+        std::cout << "Couldn't create socket set: " << SDLNet_GetError() << std::endl;
+    }
+}
+
+TcpSerial::~TcpSerial() {
+    disconnect();
+    if( socketSet ) SDLNet_FreeSocketSet(socketSet);
+    if( server ) SDLNet_TCP_Close(server);
+}
+
+bool TcpSerial::connect() {
+    if( !server || !socketSet ) {
+        return false;
+    }
+    client = SDLNet_TCP_Accept(server);
+    if( !client ) {
+        return false;
+    }
+    SDLNet_TCP_AddSocket(socketSet, client);
+    std::cout << "Network client created on port " << port << std::endl;
+    return true;
+}
+
+void TcpSerial::disconnect() {
+    if( client ) {
+        SDLNet_TCP_DelSocket(socketSet, client);
+        SDLNet_TCP_Close(client);
+        client = nullptr;
+    }
+}
+
+bool TcpSerial::write(const uint8_t *data, int length) {
+    return SDLNet_TCP_Send(client, data, length) == length;
+}
+
+int TcpSerial::read(uint8_t *data, int maxLength, int timeoutMs) {
+    if( SDLNet_CheckSockets(socketSet, timeoutMs) <= 0 ) {
+        return 0;
+    }
+    int received = SDLNet_TCP_Recv(client, data, maxLength);
+    return (received > 0) ? received : -1;
+}
+
+const char *TcpSerial::name() {
+    return label;
+}
+
+#ifndef _WIN32
+//-- Pseudo-terminal -----------------------------------------------------------
+
+PtySerial *PtySerial::open(const std::string &linkPath) {
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if( master < 0 || grantpt(master) != 0 || unlockpt(master) != 0 ) {
+        std::cout << "Serial: could not create a pseudo-terminal: " << strerror(errno) << std::endl;
+        if( master >= 0 ) close(master);
+        return nullptr;
+    }
+    std::string slaveName = ptsname(master);
+    int slave = ::open(slaveName.c_str(), O_RDWR | O_NOCTTY);
+    if( slave < 0 ) {
+        std::cout << "Serial: could not open " << slaveName << ": " << strerror(errno) << std::endl;
+        close(master);
+        return nullptr;
+    }
+
+    // Raw, so bytes pass through unchanged and nothing is echoed back to the UART
+    struct termios settings;
+    tcgetattr(slave, &settings);
+    cfmakeraw(&settings);
+    tcsetattr(slave, TCSANOW, &settings);
+    fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+
+    // Replace a link left by an earlier run, but nothing else
+    struct stat status;
+    if( lstat(linkPath.c_str(), &status) == 0 ) {
+        if( !S_ISLNK(status.st_mode) ) {
+            std::cout << "Serial: " << linkPath << " already exists and is not a link" << std::endl;
+            close(slave);
+            close(master);
+            return nullptr;
+        }
+        unlink(linkPath.c_str());
+    }
+    if( symlink(slaveName.c_str(), linkPath.c_str()) != 0 ) {
+        std::cout << "Serial: could not link " << linkPath << " to " << slaveName << ": " << strerror(errno) << std::endl;
+        close(slave);
+        close(master);
+        return nullptr;
+    }
+
+    std::cout << "Serial on " << slaveName << ", linked from " << linkPath << std::endl;
+    return new PtySerial(master, slave, linkPath);
+}
+
+PtySerial::PtySerial(int master, int slave, const std::string &linkPath) : master(master), slave(slave), linkPath(linkPath) {
+}
+
+PtySerial::~PtySerial() {
+    unlink(linkPath.c_str());
+    close(slave);
+    close(master);
+}
+
+bool PtySerial::connect() {
+    return true;
+}
+
+void PtySerial::disconnect() {
+    // Nothing can tell when a program opens the terminal, so a drop is the chance to clear out stale output
+    tcflush(slave, TCIOFLUSH);
+}
+
+bool PtySerial::write(const uint8_t *data, int length) {
+    while( length > 0 ) {
+        ssize_t written = ::write(master, data, length);
+        if( written <= 0 ) {
+            break;      // Full, as nothing is reading
+        }
+        data += written;
+        length -= written;
+    }
+    return true;
+}
+
+int PtySerial::read(uint8_t *data, int maxLength, int timeoutMs) {
+    struct pollfd input = {master, POLLIN, 0};
+    if( poll(&input, 1, timeoutMs) <= 0 ) {
+        return 0;
+    }
+    ssize_t received = ::read(master, data, maxLength);
+    return (received > 0) ? received : 0;
+}
+
+const char *PtySerial::name() {
+    return "pty";
+}
+
+//-- Standard input and output -------------------------------------------------
+
+bool StdioSerial::connect() {
+    return true;
+}
+
+void StdioSerial::disconnect() {
+}
+
+bool StdioSerial::write(const uint8_t *data, int length) {
+    while( length > 0 ) {
+        ssize_t written = ::write(STDOUT_FILENO, data, length);
+        if( written <= 0 ) {
+            break;
+        }
+        data += written;
+        length -= written;
+    }
+    return true;
+}
+
+int StdioSerial::read(uint8_t *data, int maxLength, int timeoutMs) {
+    struct pollfd input = {STDIN_FILENO, POLLIN, 0};
+    if( inputEnded || poll(&input, 1, timeoutMs) <= 0 ) {
+        if( inputEnded ) SDL_Delay(timeoutMs);
+        return 0;
+    }
+    ssize_t received = ::read(STDIN_FILENO, data, maxLength);
+    if( received <= 0 ) {
+        inputEnded = true;
+        return 0;
+    }
+    return received;
+}
+
+const char *StdioSerial::name() {
+    return "stdio";
+}
+
+bool StdioSerial::usesStdout() {
+    return true;
+}
+#endif
+
+//-- File replay ---------------------------------------------------------------
+
+ReplaySerial *ReplaySerial::open(const std::string &filename, uint32_t bytesPerSecond) {
+    std::ifstream file(filename, std::ios::binary);
+    if( !file ) {
+        std::cout << "Serial: replay file does not exist: " << filename << std::endl;
+        return nullptr;
+    }
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    std::cout << "Serial replays " << data.size() << " bytes from " << filename;
+    if( bytesPerSecond ) {
+        std::cout << " at " << bytesPerSecond << " bytes per second";
+    }
+    std::cout << std::endl;
+    return new ReplaySerial(std::move(data), bytesPerSecond);
+}
+
+ReplaySerial::ReplaySerial(std::vector<uint8_t> &&data, uint32_t bytesPerSecond) : data(std::move(data)), bytesPerSecond(bytesPerSecond) {
+}
+
+bool ReplaySerial::connect() {
+    position = 0;
+    start = std::chrono::steady_clock::now();
+    return true;
+}
+
+void ReplaySerial::disconnect() {
+}
+
+bool ReplaySerial::write(const uint8_t *, int) {
+    return true;
+}
+
+int ReplaySerial::read(uint8_t *buffer, int maxLength, int timeoutMs) {
+    size_t due = data.size();
+    if( bytesPerSecond ) {
+        uint64_t elapsedMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+        due = std::min(due, (size_t)(elapsedMs * bytesPerSecond / 1000));
+    }
+    size_t length = std::min(due - position, (size_t)maxLength);
+    if( length == 0 ) {
+        SDL_Delay(timeoutMs);
+        return 0;
+    }
+    memcpy(buffer, data.data() + position, length);
+    position += length;
+    return length;
+}
+
+const char *ReplaySerial::name() {
+    return "file";
+}
+
+//-- Link ----------------------------------------------------------------------
+
+SerialLink::SerialLink(SerialBackend *backend) : backend(backend) {
+    echo = !backend->usesStdout();
+    worker = std::thread(&SerialLink::ioThread, this);
+}
+
+SerialLink::~SerialLink() {
+    stopping = true;
+    worker.join();
+    delete backend;
+}
+
+size_t SerialLink::Ring::space() {
+    return RING_LENGTH - (tail.load(std::memory_order_relaxed) - head.load(std::memory_order_acquire));
+}
+
+size_t SerialLink::Ring::push(const uint8_t *values, size_t length) {
+    size_t end = tail.load(std::memory_order_relaxed);
+    length = std::min(length, RING_LENGTH - (end - head.load(std::memory_order_acquire)));
+    for( size_t i=0; i<length; i++ ) {
+        data[(end+i) & (RING_LENGTH-1)] = values[i];
+    }
+    tail.store(end + length, std::memory_order_release);
+    return length;
+}
+
+size_t SerialLink::Ring::pop(uint8_t *values, size_t maxLength) {
+    size_t start = head.load(std::memory_order_relaxed);
+    size_t length = std::min(maxLength, tail.load(std::memory_order_acquire) - start);
+    for( size_t i=0; i<length; i++ ) {
+        values[i] = data[(start+i) & (RING_LENGTH-1)];
+    }
+    head.store(start + length, std::memory_order_release);
+    return length;
+}
+
+void SerialLink::send(uint8_t data) {
+    // Only full if the terminal has stopped reading, when a real UART would be held off by handshaking
+    while( transmitRing.push(&data, 1) == 0 ) {
+        std::this_thread::yield();
+    }
+}
+
+int SerialLink::receive(uint8_t *data, int maxLength) {
+    return receiveRing.pop(data, maxLength);
+}
+
+bool SerialLink::isConnected() {
+    return connected;
+}
+
+void SerialLink::disconnect() {
+    dropRequested = true;
+}
+
+const char *SerialLink::name() {
+    return backend->name();
+}
+
+void SerialLink::ioThread() {
+    uint8_t buffer[RING_LENGTH];
+
+    while( !stopping ) {
+        if( dropRequested.exchange(false) ) {
+            closeBackend();
+        }
+        if( !connected ) {
+            connected = backend->connect();
+        }
+
+        // Everything transmitted since the last pass goes out together
+        size_t length = transmitRing.pop(buffer, sizeof(buffer));
+        if( length > 0 ) {
+            if( echo ) {
+                std::cout.write((char *)buffer, length);
+            }
+            if( connected && !backend->write(buffer, length) ) {
+                closeBackend();
+            }
+        }
+
+        size_t space = receiveRing.space();
+        if( !connected || space == 0 ) {
+            SDL_Delay(POLL_MS);
+            continue;
+        }
+
+        // Wait for input, but no longer than a transmitted byte should wait
+        int received = backend->read(buffer, std::min(space, sizeof(buffer)), POLL_MS);
+        if( received < 0 ) {
+            closeBackend();
+        }
+        else {
+            receiveRing.push(buffer, received);
+        }
+    }
+    closeBackend();
+}
+
+void SerialLink::closeBackend() {
+    if( connected ) {
+        backend->disconnect();
+        connected = false;
+    }
+}
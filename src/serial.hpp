@@ -0,0 +1,163 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+#include "SDL_net.h"
+
+// Where the UART's bytes go to and come from. Only used on the serial link's thread.
+class SerialBackend {
+
+    public:
+        virtual ~SerialBackend() {}
+
+        // Make or accept a connection without waiting, returning true when connected
+        virtual bool connect() = 0;
+        virtual void disconnect() = 0;
+        // Returns false if the connection has gone
+        virtual bool write(const uint8_t *data, int length) = 0;
+        // Waits up to timeoutMs for data. Returns the number of bytes read, or -1 if the connection has gone.
+        virtual int  read(uint8_t *data, int maxLength, int timeoutMs) = 0;
+        // Short description for the debug screen
+        virtual const char *name() = 0;
+        // True if transmitted data goes to standard output, where it mustn't be echoed or mixed with messages
+        virtual bool usesStdout() { return false; }
+
+        // From a command line description: tcp[:port], pty[:path], stdio or file:filename[,rate]. Returns
+        // nullptr, having said why, if the description can't be used.
+        static SerialBackend *create(const std::string &description);
+};
+
+// A terminal connecting over the network
+class TcpSerial : public SerialBackend {
+
+    public:
+        static const int DEFAULT_PORT = 8456;
+
+        TcpSerial(int port);
+        ~TcpSerial();
+
+        bool connect() override;
+        void disconnect() override;
+        bool write(const uint8_t *data, int length) override;
+        int  read(uint8_t *data, int maxLength, int timeoutMs) override;
+        const char *name() override;
+
+    private:
+        int              port;
+        char             label[8];
+        TCPsocket        server = nullptr;
+        TCPsocket        client = nullptr;
+        SDLNet_SocketSet socketSet = nullptr;
+};
+
+#ifndef _WIN32
+// A pseudo-terminal, with a symbolic link to it at a fixed path for terminal programs and scripts to open.
+// It is always connected. While nothing has the terminal open, its buffer (about 4 KB) keeps the earliest
+// output for whichever program opens it next, and output beyond that is dropped. Disconnecting discards it.
+class PtySerial : public SerialBackend {
+
+    public:
+        static constexpr const char *DEFAULT_PATH = "/tmp/beastem-tty";
+
+        static PtySerial *open(const std::string &linkPath);
+        ~PtySerial();
+
+        bool connect() override;
+        void disconnect() override;
+        bool write(const uint8_t *data, int length) override;
+        int  read(uint8_t *data, int maxLength, int timeoutMs) override;
+        const char *name() override;
+
+    private:
+        PtySerial(int master, int slave, const std::string &linkPath);
+
+        int         master;
+        int         slave;          // Held open so the terminal survives programs opening and closing it
+        std::string linkPath;
+};
+
+// Standard input and output, for running in a pipeline
+class StdioSerial : public SerialBackend {
+
+    public:
+        bool connect() override;
+        void disconnect() override;
+        bool write(const uint8_t *data, int length) override;
+        int  read(uint8_t *data, int maxLength, int timeoutMs) override;
+        const char *name() override;
+        bool usesStdout() override;
+
+    private:
+        bool inputEnded = false;
+};
+#endif
+
+// Plays a file to the UART as received data, at a fixed rate or as fast as it is taken. Transmitted data
+// is dropped. Each connection, including after [D]rop on the debug screen, starts from the beginning.
+class ReplaySerial : public SerialBackend {
+
+    public:
+        static ReplaySerial *open(const std::string &filename, uint32_t bytesPerSecond);
+
+        bool connect() override;
+        void disconnect() override;
+        bool write(const uint8_t *data, int length) override;
+        int  read(uint8_t *data, int maxLength, int timeoutMs) override;
+        const char *name() override;
+
+    private:
+        ReplaySerial(std::vector<uint8_t> &&data, uint32_t bytesPerSecond);
+
+        std::vector<uint8_t> data;
+        uint32_t             bytesPerSecond;    // 0 for as fast as it's taken
+        size_t               position = 0;
+        std::chrono::steady_clock::time_point start;
+};
+
+// Carries UART bytes to and from a backend on a background thread. The emulation thread only touches the
+// two rings, so serial traffic never costs it a system call. Transmitted bytes are gathered up and written
+// together, and echoed to the console.
+class SerialLink {
+
+    public:
+        SerialLink(SerialBackend *backend);     // Takes ownership of the backend
+        ~SerialLink();
+
+        // Emulation thread
+        void send(uint8_t data);                        // Waits if the transmit ring is full
+        int  receive(uint8_t *data, int maxLength);     // Returns the number of bytes taken
+        bool isConnected();
+        void disconnect();
+        const char *name();
+
+    private:
+        static const size_t RING_LENGTH = 1 << 14;      // Power of two
+        static const int    POLL_MS = 1;                // Longest a transmitted byte waits to be sent
+
+        // One producer and one consumer
+        struct Ring {
+            uint8_t             data[RING_LENGTH];
+            std::atomic<size_t> head{0};                // Next byte for the consumer
+            std::atomic<size_t> tail{0};                // Next free byte for the producer
+
+            size_t space();
+            size_t push(const uint8_t *values, size_t length);
+            size_t pop(uint8_t *values, size_t maxLength);
+        };
+
+        SerialBackend    *backend;
+        bool              echo;
+
+        Ring              transmitRing;
+        Ring              receiveRing;
+        std::atomic<bool> connected{false};
+        std::atomic<bool> dropRequested{false};
+        std::atomic<bool> stopping{false};
+        std::thread       worker;
+
+        void ioThread();
+        void closeBackend();
+};
@@ -6,16 +6,20 @@
 
 #include <stdint.h>
 #include <stdbool.h>
-#include <SDL_net.h>
 
 #ifdef __cplusplus
 #include <iostream> // TODO: Remove debug
+#include "serial.hpp"
 extern "C" {
 #endif
 
 #define FIFO_SIZE   16
 #define RX_BUFFER_SIZE 512
 
+// Fast mode rates, in Baud
+#define UART_FAST_OFF (0)
+#define UART_FAST_MAX (UINT64_MAX)
+
 // Bit numbers for registers
 #define LCR_BIT_PARITY (3)
 #define MSR_BIT_CTS    (4)
@@ -23,23 +27,42 @@ extern "C" {
 
 // Bitmasks for registers
 #define FIFO_ENABLE       (0x01)
+#define FCR_TRIGGER       (0xC0)
 #define LCR_PARITY_EVEN   (0x10)
 #define LCR_PARITY_STICKY (0x20)
 #define LSR_DR            (0x01)
+#define LSR_OE            (0x02)
+#define LSR_ERRORS        (0x1E)    // Overrun, parity, framing and break, which raise line status interrupts
 #define LSR_THRE          (0x20)
 #define LSR_TEMT          (0x40)
 #define MCR_OUT2          (0x08)
 
+#define IER_RX_DATA       (0x01)
+#define IER_THRE          (0x02)
+#define IER_LINE_STATUS   (0x04)
+#define IER_MODEM_STATUS  (0x08)
+
+// Interrupt identification, highest priority first
+#define IIR_NONE          (0x01)
+#define IIR_LINE_STATUS   (0x06)
+#define IIR_RX_DATA       (0x04)
+#define IIR_RX_TIMEOUT    (0x0C)
+#define IIR_THRE          (0x02)
+#define IIR_MODEM_STATUS  (0x00)
+#define IIR_FIFOS_ENABLED (0xC0)
+
 // Bit numbers for pins
 #define UART_PIN_TXRDY   (0)
 #define UART_PIN_SO      (1)
 #define UART_PIN_CTS     (2)
 #define UART_PIN_DSR     (3)
+#define UART_PIN_INT     (4)
 
 // Bitmasks for pins
 #define UART_TXRDY  (1ULL<<UART_PIN_TXRDY)
 #define UART_SO     (1ULL<<UART_PIN_SO)
 #define UART_CTS    (1ULL<<UART_PIN_CTS)
+#define UART_INT    (1ULL<<UART_PIN_INT)
 
 typedef struct {
     uint64_t clock_hz, cycle_ps;
@@ -54,6 +77,8 @@ typedef struct {
     uint8_t rx_cycles;
     uint8_t rx_bit;
     bool    is_receiving;
+    uint16_t rx_idle_ticks;     // Since a character was last received or read, for the FIFO timeout
+    bool    rx_timeout;
 
     uint8_t  tx_fifo[FIFO_SIZE];
     uint8_t  tx_pos;
@@ -61,6 +86,7 @@ typedef struct {
     uint8_t  tx_cycles;
     uint16_t tx_shift;
     uint8_t  tx_bit;
+    bool     thre_pending;      // Transmit holding register empty interrupt, until THR is written or IIR read
 
     uint8_t interrupt_enable_register;
     uint8_t interrupt_id_register;
@@ -71,15 +97,18 @@ typedef struct {
     uint8_t modem_status_register;
     uint8_t scratch_register;
 
-    TCPsocket  client, server;
-    SDLNet_SocketSet socketSet;
-    int        port;
+    // Fast mode moves whole bytes between the FIFOs and the link, rather than bits at the programmed rate
+    uint64_t fast_byte_ps;      // Time for each byte, or 0 when off
+    uint64_t fast_next_ps;
+
+    SerialLink *link;
     uint8_t    rx_buffer[RX_BUFFER_SIZE];
     uint16_t   rx_available;
     uint16_t   rx_offset;
 } uart_t;
 
-void uart_init(uart_t* uart, uint64_t clock_hz, uint64_t time_ps);
+// The UART takes ownership of the backend
+void uart_init(uart_t* uart, uint64_t clock_hz, uint64_t time_ps, SerialBackend *backend);
 
 uint64_t uart_tick(uart_t* uart, uint64_t time_ps);
 
@@ -87,11 +116,15 @@ void uart_write(uart_t* uart, uint8_t addr, uint8_t data, uint64_t time_ps);
 
 uint8_t uart_read(uart_t* uart, uint8_t addr);
 
-void uart_connect(uart_t* uart, bool connect);
+void uart_set_fast(uart_t* uart, uint64_t baud);
+
+void uart_close(uart_t* uart);
+
+void uart_disconnect(uart_t* uart);
 
 bool uart_connected(uart_t* uart);
 
-int  uart_port(uart_t* uart);
+const char *uart_name(uart_t* uart);
 
 #ifdef __cplusplus
 } // extern C
@@ -113,7 +146,7 @@ int  uart_port(uart_t* uart);
 #define _UART_UNREACHABLE
 #endif
 
-void uart_init(uart_t* uart, uint64_t clock_hz, uint64_t time_ps) {
+void uart_init(uart_t* uart, uint64_t clock_hz, uint64_t time_ps, SerialBackend *backend) {
     std::cout << "UART init. Clock rate " << clock_hz << std::endl;
 
     CHIPS_ASSERT(uart);
@@ -125,6 +158,7 @@ void uart_init(uart_t* uart, uint64_t clock_hz, uint64_t time_ps) {
     uart->divisor = 1;
 
     uart->interrupt_enable_register = 0;
+    uart->interrupt_id_register = IIR_NONE;
     uart->fifo_control_register = 0;
     uart->line_control_register = 0;
     uart->line_status_register = LSR_THRE | LSR_TEMT; // Bits 5 and 6 set
@@ -137,64 +171,139 @@ void uart_init(uart_t* uart, uint64_t clock_hz, uint64_t time_ps) {
     uart->pins |= UART_SO;  // CTS and DSR are clear
     std::cout << "Divisor "<< uart->divisor << " Baud rate : " << (uart->clock_hz / (uart->divisor) / 16) << std::endl;
 
-    uart->port = 8456;
+    // Terminals connect and are served on the link's own thread
+    uart->link = new SerialLink(backend);
+}
+
+void uart_set_fast(uart_t* uart, uint64_t baud) {
+    if( baud == UART_FAST_OFF ) {
+        uart->fast_byte_ps = 0;
+        return;
+    }
+    // Ten bits to a byte, as for 8N1, and no more than a byte each UART clock
+    uint64_t byte_ps = (baud == UART_FAST_MAX) ? 0 : UINT64_C(10000000000000) / baud;
+    uart->fast_byte_ps = (byte_ps > uart->cycle_ps) ? byte_ps : uart->cycle_ps;
+    uart->fast_next_ps = uart->last_tick_ps;
+
+    std::cout << "UART fast mode, " << (UINT64_C(10000000000000) / uart->fast_byte_ps) << " Baud" << std::endl;
+}
+
+void uart_close(uart_t* uart) {
+    delete uart->link;
+    uart->link = NULL;
+}
+
+void uart_disconnect(uart_t* uart) {
+    uart->link->disconnect();
+}
+
+bool uart_connected(uart_t* uart) {
+    return uart->link->isConnected();
+}
+
+const char *uart_name(uart_t* uart) {
+    return uart->link->name();
+}
+
+#define MSR_DELTA_CTS    (0x01)
+#define MSR_DELTA_DSR    (0x02)
+#define MSR_CTS          (0x10)
+#define MSR_DSR          (0x20)
 
-    IPaddress ip;
+// Raise the highest priority interrupt that is enabled and pending, and drive the interrupt pin to match
+static void _uart_update_interrupt(uart_t* uart) {
+    static const uint8_t TRIGGER_LEVELS[4] = {1, 4, 8, 14};
 
-    if (SDLNet_ResolveHost(&ip, NULL, uart->port) == -1) {
-      std::cout << "SDLNet_ResolveHost error: " << SDLNet_GetError() << std::endl;
-      return;
+    uint8_t enabled = uart->interrupt_enable_register;
+    bool    fifo = uart->fifo_control_register & FIFO_ENABLE;
+    uint8_t trigger = fifo ? TRIGGER_LEVELS[(uart->fifo_control_register & FCR_TRIGGER) >> 6] : 1;
+    uint8_t id = IIR_NONE;
+
+    if( (enabled & IER_LINE_STATUS) && (uart->line_status_register & LSR_ERRORS) ) {
+        id = IIR_LINE_STATUS;
+    }
+    else if( (enabled & IER_RX_DATA) && uart->rx_bytes >= trigger ) {
+        id = IIR_RX_DATA;
+    }
+    else if( (enabled & IER_RX_DATA) && uart->rx_timeout && uart->rx_bytes > 0 ) {
+        id = IIR_RX_TIMEOUT;
+    }
+    else if( (enabled & IER_THRE) && uart->thre_pending ) {
+        id = IIR_THRE;
+    }
+    else if( (enabled & IER_MODEM_STATUS) && (uart->modem_status_register & 0x0F) ) {
+        id = IIR_MODEM_STATUS;
     }
 
-    uart->server = SDLNet_TCP_Open(&ip);
-    if (!uart->server) {
-      std::cout << "SDLNet_TCP_Open error: " << SDLNet_GetError() << std::endl;
-      return;
+    uart->interrupt_id_register = id | (fifo ? IIR_FIFOS_ENABLED : 0);
+    if( id == IIR_NONE ) {
+        uart->pins &= ~UART_INT;
+    }
+    else {
+        uart->pins |= UART_INT;
     }
 }
 
-void uart_connect(uart_t* uart, bool connect) {
-    if( !connect && uart->client ) {
-        SDLNet_TCP_Close(uart->client);
-        uart->client = NULL;
+// Characters in the FIFO below the trigger level interrupt once nothing has been received or read for
+// four character times
+static void _uart_idle_tick(uart_t* uart, uint16_t ticks_per_char) {
+    if( uart->rx_bytes == 0 || !(uart->fifo_control_register & FIFO_ENABLE) ) {
+        uart->rx_idle_ticks = 0;
+        uart->rx_timeout = false;
         return;
     }
+    if( !uart->rx_timeout && ++uart->rx_idle_ticks >= 4*ticks_per_char ) {
+        uart->rx_timeout = true;
+    }
+}
 
-    uart->client = SDLNet_TCP_Accept(uart->server);
-
-    uart->rx_available = 0;
+// Bytes go straight between the FIFOs and the link, keeping the line status as it would be on the wire
+static uint64_t _uart_fast_tick(uart_t* uart, uint64_t time_ps) {
+    if( time_ps < uart->fast_next_ps ) {
+        return uart->fast_next_ps;
+    }
+    uart->fast_next_ps = time_ps + uart->fast_byte_ps;
 
-    if( !uart->client ) {
-        return;
+    if( uart->tx_bytes > 0 ) {
+        uart->link->send(uart->tx_fifo[uart->tx_pos]);
+        uart->tx_bytes -= 1;
+        if( uart->fifo_control_register & FIFO_ENABLE ) {
+            uart->tx_pos = (uart->tx_pos+1) % FIFO_SIZE;
+        }
+        uart->pins &= ~UART_TXRDY;
+        if( uart->tx_bytes == 0 ) {
+            uart->line_status_register |= LSR_THRE | LSR_TEMT;
+            uart->thre_pending = true;
+        }
     }
-    else {
-        std::cout << "Network client created on port " << uart->port << std::endl;
 
-        uart->socketSet = SDLNet_AllocSocketSet(1);
-        if( uart->socketSet ) {
-            SDLNet_TCP_AddSocket(uart->socketSet, uart->client);
+    // Only receive when there's room, so nothing is overrun however slowly the guest reads
+    bool room = (uart->fifo_control_register & FIFO_ENABLE) ? uart->rx_bytes < FIFO_SIZE : uart->rx_bytes == 0;
+    if( room ) {
+        if( uart->rx_offset == uart->rx_available ) {
+            uart->rx_available = uart->link->receive(uart->rx_buffer, RX_BUFFER_SIZE);
+            uart->rx_offset = 0;
         }
-        else {
-            std::cout << "Couldn't create socket set, closing connection" <<std::endl;
-            uart->client = NULL;
+        if( uart->rx_offset < uart->rx_available ) {
+            uart->rx_fifo[uart->rx_bytes++] = uart->rx_buffer[uart->rx_offset++];
+            uart->line_status_register |= LSR_DR;
+            uart->rx_idle_ticks = 0;
+            uart->rx_timeout = false;
         }
     }
-}
 
-bool uart_connected(uart_t* uart) {
-    return uart->client;
-}
+    // Each tick is a character time
+    _uart_idle_tick(uart, 1);
+    _uart_update_interrupt(uart);
 
-int  uart_port(uart_t* uart) {
-    return uart->port;
+    return uart->fast_next_ps;
 }
 
-#define MSR_DELTA_CTS    (0x01)
-#define MSR_DELTA_DSR    (0x02)
-#define MSR_CTS          (0x10)
-#define MSR_DSR          (0x20)
-
 uint64_t uart_tick(uart_t* uart, uint64_t time_ps) {
+    if( uart->fast_byte_ps ) {
+        return _uart_fast_tick(uart, time_ps);
+    }
+
     if( uart->last_tick_ps + (uart->cycle_ps * uart->divisor) > time_ps ) {
         return uart->pins;
     }
@@ -253,10 +362,7 @@ uint64_t uart_tick(uart_t* uart, uint64_t time_ps) {
 
                             // DEBUG OUTPUT
                             //std::cout << "Sent byte :" << (0+uart->tx_shift) << "(" << (char)uart->tx_shift << ")" << std::endl;
-                            std::cout << (char)uart->tx_shift;
-                            if( uart->client ) {
-                                SDLNet_TCP_Send(uart->client, &uart->tx_shift, 1);
-                            }
+                            uart->link->send(uart->tx_shift);
                         }
                         else {
                             uart->tx_bit += 1;
@@ -272,7 +378,7 @@ uint64_t uart_tick(uart_t* uart, uint64_t time_ps) {
                         uart->tx_bytes -= 1;
                         if( uart->tx_bytes == 0 ) {
                             uart->line_status_register |= LSR_THRE;
-                            // TODO: Generate interrupt
+                            uart->thre_pending = true;
                         }
                         if( uart->fifo_control_register & FIFO_ENABLE ) {
                             uart->tx_pos = (uart->tx_pos+1) % FIFO_SIZE;
@@ -306,15 +412,20 @@ uint64_t uart_tick(uart_t* uart, uint64_t time_ps) {
                         if( uart->rx_bytes == FIFO_SIZE) {
                             std::cout << "Buffer overrun " << std::endl;
                             uart->rx_bytes--;
+                            uart->line_status_register |= LSR_OE;
                         }
-                        // TODO - Interrupt on FIFO size
                     }
                     else {
+                        if( uart->rx_bytes > 0 ) {
+                            uart->line_status_register |= LSR_OE;   // The last byte wasn't read
+                        }
                         uart->rx_fifo[0] = uart->rx_buffer[uart->rx_offset++];  // Receive the next byte
                         uart->rx_bytes = 1;
                     }
 
                     uart->line_status_register |= LSR_DR;
+                    uart->rx_idle_ticks = 0;
+                    uart->rx_timeout = false;
 
                     if(uart->rx_offset == uart->rx_available) {
                         uart->is_receiving = false;
@@ -322,36 +433,36 @@ uint64_t uart_tick(uart_t* uart, uint64_t time_ps) {
                 } 
             }
         } else {
-            if( uart->client ) {
-                int check = SDLNet_CheckSockets(uart->socketSet, 0);
-                if( check > 0) {
-                    int available = SDLNet_TCP_Recv(uart->client, uart->rx_buffer, RX_BUFFER_SIZE);
-                    if( available > 0 ) {
-                        uart->rx_available = available;
-                        uart->is_receiving = true;
-                        uart->rx_offset = 0;
-                        uart->rx_cycles = 0;
-                        /**
-                        std::cout << "Read " << available << " bytes:\n"<<std::endl;
-                        int index = 0;
-                        while( index < available ) {
-                            std::cout << std::hex << "Read " << (index) << ": ";
-                            for( int i=0; i<16; i++ ) {
-                                if(index+i < available) {
-                                    std::cout << (0+uart->rx_buffer[index+i]) << " ";
-                                }
-                            }
-                            std::cout << std::dec << std::endl;
-                            index+=16;
+            int available = uart->link->receive(uart->rx_buffer, RX_BUFFER_SIZE);
+            if( available > 0 ) {
+                uart->rx_available = available;
+                uart->is_receiving = true;
+                uart->rx_offset = 0;
+                uart->rx_cycles = 0;
+                /**
+                std::cout << "Read " << available << " bytes:\n"<<std::endl;
+                int index = 0;
+                while( index < available ) {
+                    std::cout << std::hex << "Read " << (index) << ": ";
+                    for( int i=0; i<16; i++ ) {
+                        if(index+i < available) {
+                            std::cout << (0+uart->rx_buffer[index+i]) << " ";
                         }
-                        */
                     }
+                    std::cout << std::dec << std::endl;
+                    index+=16;
                 }
+                */
             }
         }
 
+        // Sixteen ticks to a bit
+        int lcr = uart->line_control_register;
+        _uart_idle_tick(uart, 16 * (5 + (lcr & 0x03) + ((lcr >> LCR_BIT_PARITY) & 0x01) + 2 + ((lcr >> 2) & 0x01)));
+
         uart->last_tick_ps += (uart->cycle_ps * uart->divisor);
     }
+    _uart_update_interrupt(uart);
 
     return uart->last_tick_ps + (uart->cycle_ps * uart->divisor);
 }
@@ -393,6 +504,7 @@ void uart_write(uart_t* uart, uint8_t addr, uint8_t data, uint64_t time_ps) {
                     uart->pins |= UART_TXRDY;
                 }
                 uart->line_status_register &= ~(LSR_TEMT | LSR_THRE); // Cleared when THR or shift contain data
+                uart->thre_pending = false;
             }
             break;
         case 1: // Interrupt enable register OR Divisor latch MSB
@@ -406,7 +518,11 @@ void uart_write(uart_t* uart, uint8_t addr, uint8_t data, uint64_t time_ps) {
                 uart->last_tick_ps = time_ps; // Reset the tick delay..
             }
             else {
-                uart->interrupt_enable_register = data;
+                // Enabling the THRE interrupt raises it straight away if the holding register is already empty
+                if( (data & ~uart->interrupt_enable_register & IER_THRE) && (uart->line_status_register & LSR_THRE) ) {
+                    uart->thre_pending = true;
+                }
+                uart->interrupt_enable_register = data & 0x0F;
             }
             break;
         case 2: // FIFO Control register (write)
@@ -428,7 +544,6 @@ void uart_write(uart_t* uart, uint8_t addr, uint8_t data, uint64_t time_ps) {
                     uart->tx_bytes = 0;
                 }
                 uart->fifo_control_register = data & 0x0F9;
-                // TODO: Check interrupts since FIFO depth bits may have changed...
             }
             break;
         case 3: // Line control register
@@ -447,6 +562,7 @@ void uart_write(uart_t* uart, uint8_t addr, uint8_t data, uint64_t time_ps) {
         default:
             _UART_UNREACHABLE;
     }
+    _uart_update_interrupt(uart);
 }
 
 
@@ -474,24 +590,43 @@ uint8_t uart_read(uart_t* uart, uint8_t addr) {
                 if( uart->rx_bytes == 0 ) {
                     uart->line_status_register &= ~LSR_DR;  // Clear data ready flag
                 }
+                uart->rx_idle_ticks = 0;
+                uart->rx_timeout = false;
+                _uart_update_interrupt(uart);
 
                 return result;
             }
             break;
         case 1: // Interrupt enable register OR Divisor latch MSB
-            break;
+            if(uart->line_control_register & 0x80) {
+                return uart->divisor >> 8;
+            }
+            return uart->interrupt_enable_register;
         case 2: // Interrupt identification register (read)
-            break;
+            {
+                uint8_t result = uart->interrupt_id_register;
+                if( (result & 0x0F) == IIR_THRE ) {
+                    uart->thre_pending = false;     // Cleared by reading it as the source
+                    _uart_update_interrupt(uart);
+                }
+                return result;
+            }
         case 3: // Line control register
             return uart->line_control_register;
         case 4: // Modem control register
             return uart->modem_control_register;
         case 5: // Line status register
-            return uart->line_status_register;
+            {
+                uint8_t result = uart->line_status_register;
+                uart->line_status_register &= ~LSR_ERRORS;    // Error bits cleared by read
+                _uart_update_interrupt(uart);
+                return result;
+            }
         case 6: // Modem status register
             {
                 uint8_t result =  uart->modem_status_register;
                 uart->modem_status_register &= 0xF0;  // Bottom four, delta bits, cleared by read
+                _uart_update_interrupt(uart);
                 return result;
             }
         case 7: // scratch register
@@ -2,20 +2,44 @@
 #include <iostream>
 #include <fstream>
 #include <algorithm> 
+#include <cstring>
+#include <iomanip>
 
 VideoBeast::VideoBeast(char *initialMemFile, float zoom) {
+    Scanline::init();
+    std::cout << "VideoBeast scanline kernel: " << Scanline::kernelName << std::endl;
+
     readMem(initialMemFile);
+    memcpy(host_mem, mem, sizeof(mem));
+    memset(tile_row_valid, 0, sizeof(tile_row_valid));
+    memset(vram_generation, 0, sizeof(vram_generation));
+    memset(row_signature, 0, sizeof(row_signature));
     requestedZoom = zoom;
+    buildAttributeTables();
 }
 
 VideoBeast::~VideoBeast() {
+    if( worker.joinable() ) {
+        queuePush(JournalEntry{0, 0, JOURNAL_STOP, 0});
+        worker.join();
+    }
+    if( texture ) SDL_DestroyTexture(texture);
+    if( renderer ) SDL_DestroyRenderer(renderer);
 }
 
-void VideoBeast::init(uint64_t clock_time_ps) {
-    if( surface == nullptr ) {
+void VideoBeast::init(uint64_t clock_time_ps, uint64_t clock_cycle_ps) {
+    if( window == nullptr ) {
         createWindow();
     }
 
+    // The first step happens on the CPU's next cycle
+    this->clock_cycle_ps = clock_cycle_ps;
+    next_step_ps = clock_time_ps + clock_cycle_ps;
+
+    journal.clear();
+    journal.reserve(MAX_JOURNAL);
+    journalRead = 0;
+
     next_action_time_ps = clock_time_ps;
     next_line_time_ps = clock_time_ps + VIDEO_MODE[mode].totalWidth * VIDEO_MODE[mode].pixel_clock_ps;
 
@@ -23,20 +47,50 @@ void VideoBeast::init(uint64_t clock_time_ps) {
     currentLine = 0;
     currentLayer = IDLE;
 
-    pixel_format = SDL_AllocFormat(SDL_PIXELFORMAT_RGB555);
+    rasterStarted = false;
+    rasterNextFrame_ps = next_line_time_ps;
+    rasterLine_ps = VIDEO_MODE[mode].totalWidth * VIDEO_MODE[mode].pixel_clock_ps;
+    nextInterrupt_ps = alignToCycle(rasterNextFrame_ps);
+
+    buildColourTable();
+
+    memset(sprites, 0, sizeof(sprites));
+    memset(sprite_line_count, 0, sizeof(sprite_line_count));
 
     loadRegisters("video_registers.mem");
-    loadPalette("palette_1.mem", palette1, paletteReg1);
-    loadPalette("palette_2.mem", palette2, paletteReg2);
+    loadPalette("palette_1.mem", palette1, paletteReg1, paletteMask1);
+    loadPalette("palette_2.mem", palette2, paletteReg2, paletteMask2);
+
+    memcpy(host_registers, registers, sizeof(registers));
+    host_registers[REG_INT_ENABLE] = 0;
+    host_registers[REG_INT_STATUS] = 0;
+    memcpy(host_sprites, sprites, sizeof(sprites));
+    memcpy(host_paletteReg1, paletteReg1, sizeof(paletteReg1));
+    memcpy(host_paletteReg2, paletteReg2, sizeof(paletteReg2));
+    buildWindowMap();
 
     background = getColour((registers[REG_BACKGROUND_H] << 8) + registers[REG_BACKGROUND_L]);
+    windowMode = mode;
     clearWindow();
+
+    if( threaded && !worker.joinable() ) {
+        queue.resize(QUEUE_LENGTH);
+        worker = std::thread(&VideoBeast::renderThread, this);
+    }
 }
 
-uint32_t VideoBeast::getColour(uint16_t packedRGB) {
-    uint8_t r,g,b;
-    SDL_GetRGB(packedRGB, pixel_format, &r, &g, &b);
-    return SDL_MapRGB(surface->format, r, g, b);
+void VideoBeast::buildColourTable() {
+    SDL_PixelFormat *pixel_format = SDL_AllocFormat(SDL_PIXELFORMAT_RGB555);
+    SDL_PixelFormat *output_format = SDL_AllocFormat(SDL_PIXELFORMAT_ARGB8888);
+
+    for( int packedRGB=0; packedRGB<0x8000; packedRGB++ ) {
+        uint8_t r,g,b;
+        SDL_GetRGB(packedRGB, pixel_format, &r, &g, &b);
+        colour_table[packedRGB] = SDL_MapRGB(output_format, r, g, b);
+    }
+
+    SDL_FreeFormat(pixel_format);
+    SDL_FreeFormat(output_format);
 }
 
 uint64_t VideoBeast::drawBppBitmap(int layerBase) {
@@ -47,14 +101,29 @@ uint64_t VideoBeast::drawBppBitmap(int layerBase) {
 
     int start = registers[layerBase + REG_OFF_LAYER_LEFT]*8;
     int end = registers[layerBase + REG_OFF_LAYER_RIGHT]*8;
+    int drawEnd = std::min(end, MAX_LINE_WIDTH);
+
+    uint64_t time = (end-start) * RENDER_CLOCK_PS / 2;
+    if( !drawLine ) {
+        return time;
+    }
 
     int baseAddress = (registers[layerBase + REG_OFF_BITMAP_BASE] << 14) + 512*row;
 
-    for( int x=start; x<end; x++ ) {
-        int address = baseAddress + ((scrollX++) & 0x1FF);
-        line_buffer[x] = palette2[mem[address]];
+    // Pixels are already palette indices, so copy them up to where the row wraps
+    uint8_t *indices = index_buffer + INDEX_PAD;
+    for( int x=start; x<drawEnd; ) {
+        int column = scrollX & 0x1FF;
+        int count = std::min(drawEnd-x, 0x200-column);
+
+        memcpy(indices + x, mem + baseAddress + column, count);
+        x += count;
+        scrollX += count;
+    }
+    if( drawEnd > start ) {
+        Scanline::resolveSpan(line_buffer + start, indices + start, drawEnd-start, palette2, Scanline::OPAQUE);
     }
-    return (end-start) * RENDER_CLOCK_PS / 2;
+    return time;
 }
 
 uint64_t VideoBeast::draw4ppBitmap(int layerBase) {
@@ -65,24 +134,49 @@ uint64_t VideoBeast::draw4ppBitmap(int layerBase) {
 
     int start = registers[layerBase + REG_OFF_LAYER_LEFT]*8;
     int end = registers[layerBase + REG_OFF_LAYER_RIGHT]*8;
+    int drawEnd = std::min(end, MAX_LINE_WIDTH);
+
+    uint64_t time = (end-start) * RENDER_CLOCK_PS / 4;
+    if( !drawLine ) {
+        return time;
+    }
 
     int baseAddress = (registers[layerBase + REG_OFF_BITMAP_BASE] << 14) + 512*row;
     int paletteIndex = (registers[layerBase + REG_OFF_BITMAP_PALETTE] & 0x0F) << 4;
 
-    for( int x=start; x<end; x++ ) {
-        int address = baseAddress + ((scrollX >> 1) & 0x1FF);
-        if( (scrollX & 0x01) == 0) {
-            line_buffer[x] = palette1[paletteIndex + (mem[address] >> 4)];
-        }
-        else {
-            line_buffer[x] = palette1[paletteIndex + (mem[address] & 0x0F)];
-        }
-        scrollX++;
+    // Expand whole bytes, starting a pixel early if the scroll is odd
+    int discard = scrollX & 0x01;
+    scrollX -= discard;
+
+    uint8_t *indices = index_buffer + INDEX_PAD;
+    for( int x=start-discard; x<drawEnd; x += 2 ) {
+        uint8_t pixels = mem[baseAddress + ((scrollX >> 1) & 0x1FF)];
+        indices[x]   = paletteIndex | (pixels >> 4);
+        indices[x+1] = paletteIndex | (pixels & 0x0F);
+        scrollX += 2;
     }
-    return (end-start) * RENDER_CLOCK_PS / 4;
+    if( drawEnd > start ) {
+        Scanline::resolveSpan(line_buffer + start, indices + start, drawEnd-start, palette1, Scanline::OPAQUE);
+    }
+    return time;
 }
 
 
+// Normal attributes select foreground and background directly. Sinclair attributes are FLASH, BRIGHT,
+// PAPER[2:0], INK[2:0], with BRIGHT selecting the upper 8 colours of the palette.
+void VideoBeast::buildAttributeTables() {
+    for( int attributes=0; attributes<256; attributes++ ) {
+        int bright = (attributes & 0x40) ? 8 : 0;
+        int ink    = (attributes & 0x07) + bright;
+        int paper  = ((attributes >> 3) & 0x07) + bright;
+        bool flash = (attributes & 0x80) != 0;
+
+        attribute_colours[ATTRIBUTES_NORMAL][attributes]     = attributes;
+        attribute_colours[ATTRIBUTES_SINCLAIR][attributes]   = (ink << 4) | paper;
+        attribute_colours[ATTRIBUTES_SINCLAIR+1][attributes] = flash ? ((paper << 4) | ink) : ((ink << 4) | paper);
+    }
+}
+
 uint64_t VideoBeast::drawTextLayer(int layerBase) {
     int scrollY = ((registers[layerBase + REG_OFF_LAYER_XY] & 0xF0) << 4) + registers[layerBase + REG_OFF_LAYER_Y_L];
     int scrollX = ((registers[layerBase + REG_OFF_LAYER_XY] & 0x0F) << 8) + registers[layerBase + REG_OFF_LAYER_X_L];
@@ -91,45 +185,57 @@ uint64_t VideoBeast::drawTextLayer(int layerBase) {
 
     int start = registers[layerBase + REG_OFF_LAYER_LEFT]*8;
     int end = registers[layerBase + REG_OFF_LAYER_RIGHT]*8;
+    int drawEnd = std::min(end, MAX_LINE_WIDTH);
+
+    uint64_t time = (end-start) * RENDER_CLOCK_PS / 4;
+    if( !drawLine ) {
+        return time;
+    }
 
-    int mapAddress = (registers[layerBase + REG_OFF_TEXT_MAP] << 14)  + ((row & 0x1F8) << 5); // leftmost column of current row
     int fontAddress = (registers[layerBase + REG_OFF_TEXT_FONT] << 11);
+    int bitmapAddress = (registers[layerBase + REG_OFF_TEXT_BITMAP] << 14) + (row << 7);
+    bool isBitmap = registers[layerBase + REG_OFF_TEXT_BITMAP] != 0;
+
+    // A 1bpp bitmap (128 bytes per pixel row) replaces the font, so the map only holds one attribute byte
+    // per character instead of a character and attribute pair
+    int mapAddress = (registers[layerBase + REG_OFF_TEXT_MAP] << 14) + (isBitmap ? ((row & 0x1F8) << 4) : ((row & 0x1F8) << 5));
 
     int paletteIndex = (registers[layerBase + REG_OFF_TEXT_PALETTE] & 0x0F) << 4;
+    bool isSinclair = (registers[layerBase + REG_OFF_TEXT_PALETTE] & 0x10) != 0;
+    const uint8_t *colours = attribute_colours[isSinclair ? ATTRIBUTES_SINCLAIR + ((frameCount / FLASH_FRAMES) & 0x01) : ATTRIBUTES_NORMAL];
 
     int discard = (scrollX & 0x07);
 
-    for( int x=start; x<end; ) {
-        int address = mapAddress + ((scrollX >> 2) & 0xFE);
-
-        int glyph = mem[address];
-        int attributes = mem[address+1];
+    // Expand whole glyphs into palette indices, starting 'discard' pixels before the left edge
+    uint8_t *indices = index_buffer + INDEX_PAD;
+    for( int x=start-discard; x<drawEnd; x += 8 ) {
+        int column = (scrollX >> 3) & 0x7F;
+        int attributes;
+        uint8_t glyphRow;
 
-        uint32_t foreground = palette1[paletteIndex + (attributes >> 4)];
-        bool transparentFG  = (paletteReg1[paletteIndex + (attributes >> 4)] & 0x8000) != 0;
+        if( isBitmap ) {
+            attributes = mem[mapAddress + column];
+            glyphRow = mem[bitmapAddress + column];
+        }
+        else {
+            int glyph = mem[mapAddress + 2*column];
+            attributes = mem[mapAddress + 2*column + 1];
+            glyphRow = mem[fontAddress + (8*glyph) + (row& 0x7)];
+        }
 
-        uint32_t background = palette1[paletteIndex + (attributes & 0x0F)];
-        bool transparentBG  = (paletteReg1[paletteIndex + (attributes & 0x0F)] & 0x8000) != 0;
+        uint64_t foreground = Scanline::repeat(paletteIndex + (colours[attributes] >> 4));
+        uint64_t background = Scanline::repeat(paletteIndex + (colours[attributes] & 0x0F));
 
-        uint8_t pixels = mem[fontAddress + (8*glyph) + (row& 0x7)]; // TODO: 1bpp graphics..
+        uint64_t pixels = Scanline::glyphMask(glyphRow);
+        uint64_t span = (foreground & pixels) | (background & ~pixels);
 
-        pixels <<= discard;
-        for( int count = 8-discard; count--> 0 && x < end; ) {
-            if( (pixels & 0x80) != 0 ) {
-                if( !transparentFG ) {
-                    line_buffer[x] = foreground;
-                }
-            }
-            else if( !transparentBG ) {
-                line_buffer[x] = background;
-            }
-            pixels <<= 1;
-            x++;
-        }
-        discard = 0;
+        memcpy(indices + x, &span, 8);
         scrollX += 8;
     }
-    return (end-start) * RENDER_CLOCK_PS / 4;
+    if( drawEnd > start ) {
+        Scanline::resolveSpan(line_buffer + start, indices + start, drawEnd-start, palette1, paletteMask1);
+    }
+    return time;
 }
 
 uint64_t VideoBeast::drawTileLayer(int layerBase) {
@@ -140,13 +246,22 @@ uint64_t VideoBeast::drawTileLayer(int layerBase) {
 
     int start = registers[layerBase + REG_OFF_LAYER_LEFT]*8;
     int end = registers[layerBase + REG_OFF_LAYER_RIGHT]*8;
+    int drawEnd = std::min(end, MAX_LINE_WIDTH);
+
+    uint64_t time = (end-start) * RENDER_CLOCK_PS / 2;
+    if( !drawLine ) {
+        return time;
+    }
 
     int mapAddress = (registers[layerBase + REG_OFF_TILE_MAP] << 14)  + ((row & 0x1F8) << 5); // leftmost column of current row
     int tileAddress = (registers[layerBase + REG_OFF_TILE_GRAPHIC] << 15);
 
     int discard = (scrollX & 0x07);
 
-    for( int x=start; x<end; ) {
+    // Expand whole tiles into palette indices. Hidden tiles split the line into runs that are resolved separately.
+    uint8_t *indices = index_buffer + INDEX_PAD;
+    int runStart = start;
+    for( int x=start-discard; x<drawEnd; x += 8 ) {
         int address = mapAddress + ((scrollX >> 2) & 0xFE);
 
         int tile = ((mem[address+1] & 0x03) << 8) + mem[address];
@@ -154,34 +269,136 @@ uint64_t VideoBeast::drawTileLayer(int layerBase) {
 
         if( (mem[address+1] & 0x08) == 0 ) {
             int tileBase = tileAddress + (32*tile) + (4 * (row & 0x07));
-            uint32_t pixels = ((mem[tileBase] << 24) + (mem[tileBase+1] << 16) + (mem[tileBase+2] << 8) + (mem[tileBase+3])) << (discard*4);
+            uint64_t span = tileRow(tileBase) | Scanline::repeat(paletteIndex);
 
-            for( int count = 8-discard; count--> 0 && x < end; ) {
-                int colourIdx = paletteIndex + ((pixels >> 28) & 0x0F);
-                if( (paletteReg1[colourIdx] & 0x08000) == 0) {
-                    line_buffer[x] = palette1[colourIdx];
-                }
-                pixels <<= 4;
-                x++;
-            }
+            memcpy(indices + x, &span, 8);
         }
         else {
-            x += 8-discard;
+            if( x > runStart ) {
+                Scanline::resolveSpan(line_buffer + runStart, indices + runStart, x-runStart, palette1, paletteMask1);
+            }
+            runStart = std::min(x+8, drawEnd);
         }
-        discard = 0;
         scrollX += 8;
     }
+    if( drawEnd > runStart ) {
+        Scanline::resolveSpan(line_buffer + runStart, indices + runStart, drawEnd-runStart, palette1, paletteMask1);
+    }
+
+    return time;
+}
+
+// Sort the sprites of each sprite layer into the lines they cover, so drawing a line only visits the
+// sprites on it. Like the hardware, only MAX_SPRITES_PER_LINE sprites are shown on any one line.
+void VideoBeast::bucketSprites() {
+    int lines = isDoubled ? VIDEO_MODE[mode].pixelHeight/2 : VIDEO_MODE[mode].pixelHeight;
+
+    for( int layer=0; layer<MAX_LAYERS; layer++ ) {
+        int layerBase = 0x80 + (16 * layer);
+        memset(sprite_line_count[layer], 0, sizeof(sprite_line_count[layer]));
+
+        if( registers[layerBase + REG_OFF_LAYER_TYPE] != LAYER_TYPE_SPRITE ) {
+            continue;
+        }
+
+        int scrollY = ((registers[layerBase + REG_OFF_LAYER_XY] & 0xF0) << 4) + registers[layerBase + REG_OFF_LAYER_Y_L];
+        int top    = std::max(0, 8*registers[layerBase + REG_OFF_LAYER_TOP]);
+        int bottom = std::min(lines, 8*(registers[layerBase + REG_OFF_LAYER_BOTTOM]+1));
+
+        int first = registers[layerBase + REG_OFF_SPRITE_FIRST];
+        int count = registers[layerBase + REG_OFF_SPRITE_COUNT];
+
+        for( int i=0; i<count; i++ ) {
+            int sprite = (first + i) & (MAX_SPRITES-1);
+            const uint8_t *entry = sprites + sprite*SPRITE_BYTES;
+
+            if( (entry[SPRITE_ATTR] & 0x08) != 0 ) {
+                continue;
+            }
+            int y = ((entry[SPRITE_XY] & 0xF0) << 4) + entry[SPRITE_Y_L];
+            int height = 8 * (((entry[SPRITE_SIZE] >> 4) & 0x07) + 1);
+
+            // Lines where the layer row (currentLine - top + scrollY) falls within the sprite
+            int from = std::max(top, y + top - scrollY);
+            int to   = std::min(bottom, y + top - scrollY + height);
+
+            for( int line=from; line<to; line++ ) {
+                uint8_t &lineCount = sprite_line_count[layer][line];
+                if( lineCount < MAX_SPRITES_PER_LINE ) {
+                    sprite_lines[layer][line][lineCount++] = sprite;
+                }
+            }
+        }
+    }
+}
+
+uint64_t VideoBeast::drawSpriteLayer(int layerBase) {
+    int layer = (layerBase - 0x80) / 16;
+    if( currentLine >= MAX_LINES ) {
+        return RENDER_CLOCK_PS;
+    }
+
+    int scrollY = ((registers[layerBase + REG_OFF_LAYER_XY] & 0xF0) << 4) + registers[layerBase + REG_OFF_LAYER_Y_L];
+    int scrollX = ((registers[layerBase + REG_OFF_LAYER_XY] & 0x0F) << 8) + registers[layerBase + REG_OFF_LAYER_X_L];
+
+    int row = (currentLine - 8*registers[layerBase + REG_OFF_LAYER_TOP]) + scrollY;
+
+    int start = registers[layerBase + REG_OFF_LAYER_LEFT]*8;
+    int end = registers[layerBase + REG_OFF_LAYER_RIGHT]*8;
+    int drawEnd = std::min(end, MAX_LINE_WIDTH);
 
-    return (end-start) * RENDER_CLOCK_PS / 2;
+    int tileAddress = (registers[layerBase + REG_OFF_SPRITE_GRAPHIC] << 15);
+
+    uint8_t *indices = index_buffer + INDEX_PAD;
+    int tilesDrawn = 0;
+
+    // Later sprites in the list are drawn over earlier ones
+    int count = sprite_line_count[layer][currentLine];
+    for( int i=0; i<count; i++ ) {
+        const uint8_t *entry = sprites + sprite_lines[layer][currentLine][i]*SPRITE_BYTES;
+
+        int width = ((entry[SPRITE_SIZE] & 0x07) + 1);
+        int height = 8 * (((entry[SPRITE_SIZE] >> 4) & 0x07) + 1);
+        int spriteRow = row - (((entry[SPRITE_XY] & 0xF0) << 4) + entry[SPRITE_Y_L]);
+
+        // Buckets are built at the start of the frame, so skip sprites that have since moved or been hidden
+        if( spriteRow < 0 || spriteRow >= height || (entry[SPRITE_ATTR] & 0x08) != 0 ) {
+            continue;
+        }
+
+        int tile = ((entry[SPRITE_ATTR] & 0x03) << 8) + entry[SPRITE_TILE] + width * (spriteRow >> 3);
+        int paletteIndex = entry[SPRITE_ATTR] & 0xF0;
+        int x = start + ((entry[SPRITE_XY] & 0x0F) << 8) + entry[SPRITE_X_L] - scrollX;
+
+        for( int column=0; column<width; column++, tile++, x += 8 ) {
+            int left  = std::max(x, start);
+            int right = std::min(x+8, drawEnd);
+            if( left >= right ) {
+                continue;
+            }
+
+            if( drawLine ) {
+                int tileBase = tileAddress + (32*(tile & 0x3FF)) + (4 * (spriteRow & 0x07));
+                uint64_t span = tileRow(tileBase) | Scanline::repeat(paletteIndex);
+
+                memcpy(indices + x, &span, 8);
+                Scanline::resolveSpan(line_buffer + left, indices + left, right-left, palette1, paletteMask1);
+            }
+            tilesDrawn++;
+        }
+    }
+
+    return RENDER_CLOCK_PS + (tilesDrawn * 8 * RENDER_CLOCK_PS / 2);
 }
 
-void VideoBeast::loadPalette(const char *filename, uint32_t *palette, uint16_t *paletteReg) {
+void VideoBeast::loadPalette(const char *filename, uint32_t *palette, uint16_t *paletteReg, uint32_t *paletteMask) {
     std::ifstream myfile(filename);
     if(!myfile) {
         std::cout << "Palette file does not exist: " << filename << std::endl;
         exit(1);
     }
     std::string line;
+    uint16_t colours[PALETTE_LENGTH];
     int idx = 0;
 
     while (std::getline(myfile, line)) {
@@ -189,15 +406,24 @@ void VideoBeast::loadPalette(const char *filename, uint32_t *palette, uint16_t *
             std::cerr << "WARNING: Palette length is exceeded in file " << filename << std::endl;
             break;
         }
-        uint16_t colour555 = std::stoi(line, nullptr, 16);
-        paletteReg[idx] = colour555;
-        palette[idx++] = getColour(colour555);
+        colours[idx++] = std::stoi(line, nullptr, 16);
     }
+    uploadPalette(palette, paletteReg, paletteMask, 0, colours, idx);
     std::cout << "Read " << idx << " entries for palette from file " << filename << std::endl;
     
     myfile.close();
 }
 
+void VideoBeast::uploadPalette(uint32_t *palette, uint16_t *paletteReg, uint32_t *paletteMask, int first, const uint16_t *colours, int count) {
+    for( int i=0; i<count; i++ ) {
+        uint16_t colour555 = colours[i];
+        paletteReg[first+i] = colour555;
+        paletteMask[first+i] = (colour555 & 0x8000) ? 0 : 0xFFFFFFFF;
+        palette[first+i] = colour_table[colour555 & 0x7FFF];
+    }
+    paletteGeneration++;
+}
+
 void VideoBeast::loadRegisters(const char *filename) {
     std::ifstream myfile(filename);
     if(!myfile) {
@@ -232,41 +458,507 @@ void VideoBeast::handleEvent(SDL_Event windowEvent) {
             case SDLK_b :
                 layer_time_alpha = 1.0-layer_time_alpha;
                 break;
+            case SDLK_s :
+                printStats();
+                break;
+            case SDLK_w :
+                showWrites = !showWrites;
+                break;
+            case SDLK_x :
+                exportWrites();
+                break;
+        }
+    }
+}
+
+void VideoBeast::setFrameSkip(int frames) {
+    frameSkip = frames;
+}
+
+// Decide at the start of each frame whether to draw it
+bool VideoBeast::shouldRender(uint64_t clock_time_ps) {
+    if( frameSkip == 0 || capture ) {
+        return true;
+    }
+    if( frameSkip > 0 ) {
+        if( skippedFrames < frameSkip ) {
+            skippedFrames++;
+            return false;
         }
+        skippedFrames = 0;
+        return true;
     }
+
+    if( (SDL_GetWindowFlags(window) & (SDL_WINDOW_HIDDEN | SDL_WINDOW_MINIMIZED)) != 0 ) {
+        return false;
+    }
+
+    uint64_t now = SDL_GetPerformanceCounter();
+    double frequency = SDL_GetPerformanceFrequency();
+    double framePeriod = VIDEO_MODE[mode].totalWidth * VIDEO_MODE[mode].totalHeight * VIDEO_MODE[mode].pixel_clock_ps / 1e12;
+
+    double lag = (now - pacingStartCounter) / frequency - (clock_time_ps - pacingStartPs) / 1e12;
+    if( lag > MAX_LAG_SECONDS || lag < -MAX_LAG_SECONDS ) {
+        // Stopped in the debugger, or just started, so measure from here
+        pacingStartCounter = now;
+        pacingStartPs = clock_time_ps;
+        lag = 0;
+    }
+
+    // Skip while behind real time, to catch up, or when frames arrive faster than they can be seen
+    bool behind = lag > framePeriod;
+    bool tooSoon = (now - lastPresentCounter) / frequency < framePeriod / 2;
+
+    if( (behind || tooSoon) && skippedFrames < MAX_AUTO_SKIP ) {
+        skippedFrames++;
+        return false;
+    }
+    skippedFrames = 0;
+    return true;
 }
 
-void VideoBeast::tickNextFrame() {
+void VideoBeast::tickNextFrame(uint64_t clock_time_ps) {
     drawNextLine = true;
     displayLine = 0;
     currentLine = 0;
-    SDL_UpdateWindowSurface(window);
+    if( renderFrame ) {
+        if( showWrites ) {
+            drawWriteMarkers();
+        }
+        finishFrame();
+    }
+    endFrameTiming();
+    endFrameWrites();
+    renderFrame = shouldRender(clock_time_ps);
+    frameCount++;
     isDoubled = (registers[REG_MODE] & 0x08) != 0;
+    bucketSprites();
+    bucketGeneration = spriteGeneration;
 
     if( mode != (registers[REG_MODE] & 0x7) ) {
         mode = registers[REG_MODE] & 0x7;
         if( mode >= VIDEO_MODES ) {
             std::cout << "Unsupported video mode " << mode << std::endl;
         } 
+    }
+}
+
+uint64_t VideoBeast::alignToCycle(uint64_t time_ps) {
+    return ((time_ps + clock_cycle_ps - 1) / clock_cycle_ps) * clock_cycle_ps;
+}
+
+void VideoBeast::setThreaded(bool threaded) {
+    this->threaded = threaded;
+}
+
+void VideoBeast::setCapture(FrameCapture *capture) {
+    this->capture = capture;
+}
+
+void VideoBeast::publish(uint8_t target, uint32_t index, uint8_t data, uint64_t clock_time_ps) {
+    if( threaded ) {
+        queuePush(JournalEntry{clock_time_ps, index, target, data});
+    }
+    else {
+        journalWrite(target, index, data, clock_time_ps);
+    }
+}
+
+void VideoBeast::requestRender(uint64_t clock_time_ps, bool inclusive, bool wait) {
+    if( !threaded ) {
+        renderUntil(clock_time_ps, inclusive);
+        return;
+    }
+    uint32_t request = ++renderRequests;
+    queuePush(JournalEntry{clock_time_ps, request, JOURNAL_RENDER, inclusive});
+
+    if( wait ) {
+        while( renderedRequest.load(std::memory_order_acquire) != request ) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void VideoBeast::queuePush(const JournalEntry &entry) {
+    size_t tail = queueTail.load(std::memory_order_relaxed);
+    while( tail - queueHead.load(std::memory_order_acquire) >= QUEUE_LENGTH ) {
+        std::this_thread::yield();
+    }
+    queue[tail & (QUEUE_LENGTH-1)] = entry;
+    queueTail.store(tail+1);
+
+    if( workerSleeping.load() ) {
+        // Take the lock so the wake can't slip in between the worker checking the queue and waiting
+        { std::lock_guard<std::mutex> lock(wakeLock); }
+        workerWake.notify_one();
+    }
+}
+
+bool VideoBeast::queuePop(JournalEntry &entry) {
+    size_t head = queueHead.load(std::memory_order_relaxed);
+    if( head == queueTail.load(std::memory_order_acquire) ) {
+        return false;
+    }
+    entry = queue[head & (QUEUE_LENGTH-1)];
+    queueHead.store(head+1, std::memory_order_release);
+    return true;
+}
+
+void VideoBeast::renderThread() {
+    int idle = 0;
+    while( true ) {
+        JournalEntry entry;
+        if( !queuePop(entry) ) {
+            if( ++idle < WORKER_SPIN ) {
+                std::this_thread::yield();
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(wakeLock);
+            workerSleeping.store(true);
+            workerWake.wait(lock, [this] { return queueHead.load() != queueTail.load(); });
+            workerSleeping.store(false);
+            continue;
+        }
+        idle = 0;
+
+        if( entry.target == JOURNAL_STOP ) {
+            break;
+        }
+        if( entry.target == JOURNAL_RENDER ) {
+            renderUntil(entry.time_ps, entry.data != 0);
+            renderedRequest.store(entry.index, std::memory_order_release);
+        }
         else {
-            updateMode();
+            journalWrite(entry.target, entry.index, entry.data, entry.time_ps);
         }
     }
 }
 
+void VideoBeast::journalWrite(uint8_t target, uint32_t index, uint8_t data, uint64_t clock_time_ps) {
+    if( journal.size() >= MAX_JOURNAL ) {
+        renderUntil(clock_time_ps, false);
+    }
+    journal.push_back(JournalEntry{clock_time_ps, index, target, data});
+}
+
+// Replay journaled writes made up to and including the given time into the renderer's view
+void VideoBeast::applyJournal(uint64_t clock_time_ps) {
+    while( journalRead < journal.size() && journal[journalRead].time_ps <= clock_time_ps ) {
+        const JournalEntry &entry = journal[journalRead++];
+
+        // A write part way through a line means its pixels no longer follow from its signature
+        if( lineSignature != 0 && currentLayer != IDLE ) {
+            forgetLine();
+        }
+        if( showWrites ) {
+            recordWrite(entry);
+        }
+
+        switch( entry.target ) {
+            case JOURNAL_MEM :
+                mem[entry.index] = entry.data;
+                tile_row_valid[entry.index >> 8] &= ~(1ULL << ((entry.index >> 2) & 63));
+                vram_generation[entry.index >> VRAM_REGION_BITS]++;
+                break;
+            case JOURNAL_REGISTER :
+                registers[entry.index] = entry.data;
+                break;
+            case JOURNAL_SPRITE :
+                sprites[entry.index] = entry.data;
+                spriteGeneration++;
+                break;
+            case JOURNAL_PALETTE_1 :
+            case JOURNAL_PALETTE_2 : {
+                bool isFirst = entry.target == JOURNAL_PALETTE_1;
+                uint16_t *paletteReg = isFirst ? paletteReg1 : paletteReg2;
+                int idx = entry.index >> 1;
+
+                uint16_t colour555 = ((entry.index & 0x01) == 0) ? (paletteReg[idx] & 0xFF00) | entry.data
+                                                                 : (paletteReg[idx] & 0x0FF) | (entry.data << 8);
+                uploadPalette(isFirst ? palette1 : palette2, paletteReg, isFirst ? paletteMask1 : paletteMask2, idx, &colour555, 1);
+                break;
+            }
+        }
+    }
+    if( journalRead == journal.size() ) {
+        journal.clear();
+        journalRead = 0;
+    }
+}
+
+void VideoBeast::renderUntil(uint64_t clock_time_ps, bool inclusive) {
+    renderTarget_ps = clock_time_ps;
+    while( true ) {
+        uint64_t stepTime = alignToCycle(next_step_ps);
+        if( inclusive ? stepTime > clock_time_ps : stepTime >= clock_time_ps ) {
+            break;
+        }
+        applyJournal(stepTime);
+        next_step_ps = step(stepTime);
+    }
+    applyJournal(clock_time_ps);
+}
+
 uint64_t VideoBeast::tick(uint64_t clock_time_ps) {
+    if( threaded ) {
+        // The raster belongs to the worker, so check back twice a frame for finished frames
+        requestRender(clock_time_ps, true, false);
+        showFrame();
+
+        int hostMode = std::min(host_registers[REG_MODE] & 0x07, VIDEO_MODES-1);
+        return clock_time_ps + VIDEO_MODE[hostMode].totalWidth * VIDEO_MODE[hostMode].totalHeight * VIDEO_MODE[hostMode].pixel_clock_ps / 2;
+    }
+
+    renderUntil(clock_time_ps, true);
+    showFrame();
+
+    uint64_t linePeriod = VIDEO_MODE[mode].totalWidth * VIDEO_MODE[mode].pixel_clock_ps;
+    return next_line_time_ps + (VIDEO_MODE[mode].totalHeight - 1 - displayLine) * linePeriod;
+}
+
+void VideoBeast::catchUp(uint64_t clock_time_ps) {
+    if( previewValid && previewTime_ps == clock_time_ps ) {
+        // Nothing has been written since, so the preview is already up to date
+        return;
+    }
+    // Once the worker has caught up it waits for more of the journal, so the renderer's state can be used here
+    requestRender(clock_time_ps, true, true);
+    renderPreview();
+    previewTime_ps = clock_time_ps;
+    previewValid = true;
+
+    if( previewMode != windowMode ) {
+        windowMode = previewMode;
+        updateMode(windowMode);
+    }
+    presentFrame(preview_buffer, previewMode);
+}
+
+void VideoBeast::finishFrame() {
+    if( capture && mode < VIDEO_MODES ) {
+        const VideoMode &videoMode = VIDEO_MODE[mode];
+        uint64_t framePeriodPs = (uint64_t)videoMode.totalWidth * videoMode.totalHeight * videoMode.pixel_clock_ps;
+        capture->addFrame(frame_buffer, MAX_LINE_WIDTH, videoMode.pixelWidth, videoMode.pixelHeight, frameCount, framePeriodPs);
+    }
+
+    std::lock_guard<std::mutex> lock(frameLock);
+    std::swap(frame_buffer, ready_buffer);
+    readyMode = mode;
+    readyFresh = true;
+}
+
+void VideoBeast::showFrame() {
+    std::unique_lock<std::mutex> lock(frameLock);
+    if( !readyFresh ) {
+        return;
+    }
+    readyFresh = false;
+
+    if( readyMode != windowMode && readyMode < VIDEO_MODES ) {
+        windowMode = readyMode;
+        updateMode(windowMode);
+    }
+    presentFrame(ready_buffer, readyMode);
+    lastPresentCounter = SDL_GetPerformanceCounter();
+}
+
+// Fold the write generations of the video RAM regions a line reads into its signature
+uint64_t VideoBeast::regionSignature(uint64_t signature, uint32_t address, uint32_t length) {
+    uint32_t last = (address + length - 1) >> VRAM_REGION_BITS;
+    for( uint32_t region = address >> VRAM_REGION_BITS; region <= last; region++ ) {
+        signature = (signature ^ vram_generation[region & (VRAM_REGIONS-1)]) * SIGNATURE_PRIME;
+    }
+    return signature;
+}
+
+// Everything that decides the pixels of the current line, as of its start: the mode, the layer registers,
+// palette and sprite changes, and the video RAM each visible layer reads from
+uint64_t VideoBeast::signLine() {
+    uint64_t signature = SIGNATURE_BASIS;
+    auto mix = [&signature](uint64_t value) {
+        signature = (signature ^ value) * SIGNATURE_PRIME;
+    };
+
+    mix(currentLine | (mode << 16) | (isDoubled ? 0x100000 : 0));
+    mix((registers[REG_BACKGROUND_H] << 8) | registers[REG_BACKGROUND_L]);
+    mix(paletteGeneration);
+    mix(spriteGeneration);
+    mix(bucketGeneration);
+
+    for( int layer=0; layer<MAX_LAYERS; layer++ ) {
+        int layerBase = 0x80 + (16 * layer);
+        uint64_t layerRegisters[2];
+        memcpy(layerRegisters, registers + layerBase, sizeof(layerRegisters));
+        mix(layerRegisters[0]);
+        mix(layerRegisters[1]);
+
+        if( currentLine <  8*registers[layerBase + REG_OFF_LAYER_TOP] ||
+            currentLine >= 8*(registers[layerBase + REG_OFF_LAYER_BOTTOM]+1) ) {
+            continue;
+        }
+        int scrollY = ((registers[layerBase + REG_OFF_LAYER_XY] & 0xF0) << 4) + registers[layerBase + REG_OFF_LAYER_Y_L];
+        int row = ((currentLine - 8*registers[layerBase + REG_OFF_LAYER_TOP]) + scrollY ) & 0x1FF;
+
+        switch( registers[layerBase + REG_OFF_LAYER_TYPE] ) {
+            case LAYER_TYPE_TEXT : {
+                int mapBase = registers[layerBase + REG_OFF_TEXT_MAP] << 14;
+                if( (registers[layerBase + REG_OFF_TEXT_PALETTE] & 0x10) != 0 ) {
+                    mix((frameCount / FLASH_FRAMES) & 0x01);
+                }
+                if( registers[layerBase + REG_OFF_TEXT_BITMAP] != 0 ) {
+                    signature = regionSignature(signature, mapBase + ((row & 0x1F8) << 4), 128);
+                    signature = regionSignature(signature, (registers[layerBase + REG_OFF_TEXT_BITMAP] << 14) + (row << 7), 128);
+                }
+                else {
+                    signature = regionSignature(signature, mapBase + ((row & 0x1F8) << 5), 256);
+                    signature = regionSignature(signature, registers[layerBase + REG_OFF_TEXT_FONT] << 11, 2048);
+                }
+                break;
+            }
+            case LAYER_TYPE_TILE :
+                signature = regionSignature(signature, (registers[layerBase + REG_OFF_TILE_MAP] << 14) + ((row & 0x1F8) << 5), 256);
+                signature = regionSignature(signature, registers[layerBase + REG_OFF_TILE_GRAPHIC] << 15, 32768);
+                break;
+            case LAYER_TYPE_SPRITE :
+                signature = regionSignature(signature, registers[layerBase + REG_OFF_SPRITE_GRAPHIC] << 15, 32768);
+                break;
+            case LAYER_TYPE_8BPP :
+            case LAYER_TYPE_4BPP :
+                signature = regionSignature(signature, (registers[layerBase + REG_OFF_BITMAP_BASE] << 14) + 512*row, 512);
+                break;
+        }
+    }
+    return signature == 0 ? 1 : signature;
+}
+
+// Decide at the start of a line whether to draw it. Lines below the screen are never shown, and a line
+// whose frame buffer rows already hold pixels drawn from the same signature can be left as it is. That
+// needs the journal to show that nothing is written while the line is being drawn.
+bool VideoBeast::needsDrawing() {
+    int firstRow = isDoubled ? 2*currentLine : currentLine;
+    int lastRow = isDoubled ? firstRow + 1 : firstRow;
+
+    lineSignature = 0;
+    if( firstRow >= VIDEO_MODE[mode].pixelHeight ) {
+        return false;
+    }
+    if( debug_layers ) {
+        return true;
+    }
+    lineSignature = signLine();
+
+    uint64_t quietUntil = next_line_time_ps + VIDEO_MODE[mode].totalWidth * VIDEO_MODE[mode].pixel_clock_ps;
+    bool quiet = renderTarget_ps >= quietUntil &&
+                 (journalRead == journal.size() || journal[journalRead].time_ps >= quietUntil);
+    if( !quiet || lastRow >= MAX_LINES ) {
+        return true;
+    }
+
+    const uint64_t *signatures = row_signature[frame_buffer == frame_buffers[0] ? 0 : 1];
+    return signatures[firstRow] != lineSignature || signatures[lastRow] != lineSignature;
+}
+
+void VideoBeast::forgetLine() {
+    if( !drawLine ) {
+        // The rows were kept from an earlier frame, so have them drawn again next time
+        int firstRow = isDoubled ? 2*currentLine : currentLine;
+        uint64_t *signatures = row_signature[frame_buffer == frame_buffers[0] ? 0 : 1];
+        for( int row=firstRow; row<=firstRow+(isDoubled ? 1 : 0) && row<MAX_LINES; row++ ) {
+            signatures[row] = 0;
+        }
+    }
+    lineSignature = 0;
+}
+
+// Draw a layer that covers currentLine into line_buffer, returning the time the layer takes
+uint64_t VideoBeast::drawLayer(int layerBase) {
+    switch( registers[ layerBase + REG_OFF_LAYER_TYPE ]) {
+        case LAYER_TYPE_TEXT :
+            return drawTextLayer(layerBase);
+        case LAYER_TYPE_SPRITE :
+            return drawSpriteLayer(layerBase);
+        case LAYER_TYPE_TILE : 
+            return drawTileLayer(layerBase);
+        case LAYER_TYPE_8BPP :
+            return drawBppBitmap(layerBase);
+        case LAYER_TYPE_4BPP : 
+            return draw4ppBitmap(layerBase);
+    }
+    return RENDER_CLOCK_PS*3;
+}
+
+void VideoBeast::copyLine(uint32_t *dest) {
+    int width = VIDEO_MODE[mode].pixelWidth;
+    if( isDoubled ) {
+        for( int i=0; i<width; i++ ) {
+            dest[i] = line_buffer[i >> 1];
+        }
+    }
+    else {
+        memcpy(dest, line_buffer, width * sizeof(uint32_t));
+    }
+}
+
+// Draw a whole frame from the renderer's current state into preview_buffer, one line after another with no
+// raster timing. The raster is left where it was, so running on finishes the frame it was part way through.
+void VideoBeast::renderPreview() {
+    uint16_t savedLine = currentLine;
+    bool     savedDrawLine = drawLine;
+    int      savedMode = mode;
+    bool     savedDoubled = isDoubled;
+    memcpy(preview_line_buffer, line_buffer, sizeof(line_buffer));
+    memcpy(preview_sprite_lines, sprite_lines, sizeof(sprite_lines));
+    memcpy(preview_sprite_line_count, sprite_line_count, sizeof(sprite_line_count));
+
+    // As the next frame would be drawn
+    mode = std::min(registers[REG_MODE] & 0x07, VIDEO_MODES-1);
+    isDoubled = (registers[REG_MODE] & 0x08) != 0;
+    bucketSprites();
+
+    int lines = isDoubled ? VIDEO_MODE[mode].pixelHeight/2 : VIDEO_MODE[mode].pixelHeight;
+    drawLine = true;
+    for( currentLine=0; currentLine<lines; currentLine++ ) {
+        for( int i=0; i<MAX_LINE_WIDTH; i++ ) {
+            line_buffer[i] = background;
+        }
+        for( int layer=0; layer<MAX_LAYERS; layer++ ) {
+            int layerBase = 0x80 + (16 * layer);
+            if( currentLine >= 8* registers[layerBase + REG_OFF_LAYER_TOP] &&
+                currentLine <  8*(registers[layerBase + REG_OFF_LAYER_BOTTOM]+1) ) {
+                drawLayer(layerBase);
+            }
+        }
+
+        int row = isDoubled ? 2*currentLine : currentLine;
+        copyLine(preview_buffer + row * MAX_LINE_WIDTH);
+        if( isDoubled ) {
+            copyLine(preview_buffer + (row+1) * MAX_LINE_WIDTH);
+        }
+    }
+    previewMode = mode;
+
+    currentLine = savedLine;
+    drawLine = savedDrawLine;
+    mode = savedMode;
+    isDoubled = savedDoubled;
+    memcpy(line_buffer, preview_line_buffer, sizeof(line_buffer));
+    memcpy(sprite_lines, preview_sprite_lines, sizeof(sprite_lines));
+    memcpy(sprite_line_count, preview_sprite_line_count, sizeof(sprite_line_count));
+}
+
+uint64_t VideoBeast::step(uint64_t clock_time_ps) {
     if( clock_time_ps >= next_line_time_ps ) {
         next_line_time_ps += VIDEO_MODE[mode].totalWidth * VIDEO_MODE[mode].pixel_clock_ps;      
 
         if( ++displayLine >= VIDEO_MODE[mode].totalHeight ) {
-            tickNextFrame();
+            tickNextFrame(clock_time_ps);
         }
         else if( !isDoubled || ((displayLine & 0x01) == 0)) {
             drawNextLine = true;
             currentLine++;
         }
 
-        if (debug_layers && displayLine <= VIDEO_MODE[mode].pixelHeight ) {
+        if (drawLine && debug_layers && displayLine <= VIDEO_MODE[mode].pixelHeight ) {
             int screenWidth = VIDEO_MODE[mode].pixelWidth;
             if( isDoubled ) screenWidth /= 2;
 
@@ -275,9 +967,9 @@ uint64_t VideoBeast::tick(uint64_t clock_time_ps) {
             int current = 0;
 
             for( int i=0; i<screenWidth; i++ ) {
-                int r = (int)((line_buffer[i] & 0x0FF) * layer_time_alpha);
+                int r = (int)(((line_buffer[i] >> 16) & 0x0FF) * layer_time_alpha);
                 int g = (int)(((line_buffer[i] >> 8) & 0x0FF) * layer_time_alpha);
-                int b = (int)(((line_buffer[i] >> 16) & 0x0FF) * layer_time_alpha);
+                int b = (int)((line_buffer[i] & 0x0FF) * layer_time_alpha);
 
                 if( current < MAX_LAYER_TIMES ) {
                     if( layer_times_ps[current] < (i/scale) ) {
@@ -293,29 +985,20 @@ uint64_t VideoBeast::tick(uint64_t clock_time_ps) {
                     }
                 }
 
-                line_buffer[i] = r + (g<<8) + (b<<16);
+                line_buffer[i] = 0xFF000000 | (r<<16) | (g<<8) | b;
             }
+            drawTimingOverlay(displayLine-1, screenWidth);
         }
 
-        if( displayLine > 0 && displayLine <= VIDEO_MODE[mode].pixelHeight ) {
-            int step = (int)(isDoubled ? zoom * 2.0 : zoom);
-                
-            int dest = (displayLine-1)*surface->pitch * zoom;
-            int line = (displayLine-1);
+        if( drawLine && displayLine > 0 && displayLine <= VIDEO_MODE[mode].pixelHeight ) {
+            uint32_t *dest = frame_buffer + (displayLine-1) * MAX_LINE_WIDTH;
+
+            row_signature[frame_buffer == frame_buffers[0] ? 0 : 1][displayLine-1] = lineSignature;
 
-            // TODO: This is a bit nasty - lots of assumptions about bytes per pixel..
-            // ;VIDEO_MODE[mode].pixelWidth
             if( debugFromNs != 0 ) {
                 std::cout << "Draw line " << (displayLine-1) << " current line " << currentLine << " time " << (clock_time_ps/1000 - debugFromNs) << std::endl;
             }
-            for(int row=0; row<zoom; row++) {
-                if( line++ < surface->h ) {
-                    for(int i=0; i<surface->w; i++) {
-                        *(Uint32 *)((Uint8 *)surface->pixels+dest) = line_buffer[i/step];
-                        dest += surface->format->BytesPerPixel;
-                    }
-                }
-            }
+            copyLine(dest);
         }
     }
 
@@ -324,8 +1007,11 @@ uint64_t VideoBeast::tick(uint64_t clock_time_ps) {
             if( debugFromNs != 0 ) {
                 std::cout << "Clear line " << (displayLine-1) << " current line " << currentLine << " time " << (clock_time_ps/1000 - debugFromNs) << std::endl;
             }
-            for( int i=0; i<MAX_LINE_WIDTH; i++ ) {
-                line_buffer[i] = background;
+            drawLine = renderFrame && needsDrawing();
+            if( drawLine ) {
+                for( int i=0; i<MAX_LINE_WIDTH; i++ ) {
+                    line_buffer[i] = background;
+                }
             }
             if( debug_layers ) {
                 layer_time_index = 0;
@@ -338,6 +1024,7 @@ uint64_t VideoBeast::tick(uint64_t clock_time_ps) {
                 layer_col_b[0] = 196;
             }
             currentLayer = 0;
+            lineStart_ps = clock_time_ps;
             next_action_time_ps = clock_time_ps + MAX_LINE_WIDTH*RENDER_CLOCK_PS/4;
             drawNextLine = false;
         }
@@ -356,22 +1043,7 @@ uint64_t VideoBeast::tick(uint64_t clock_time_ps) {
             
             debug_colour = 1+registers[ layer_base + REG_OFF_LAYER_TYPE ];
 
-            switch( registers[ layer_base + REG_OFF_LAYER_TYPE ]) {
-                case LAYER_TYPE_NONE : 
-                    break;
-                case LAYER_TYPE_TEXT :
-                    next_action_time_ps = clock_time_ps + drawTextLayer(layer_base);
-                    break;
-                case LAYER_TYPE_TILE : 
-                    next_action_time_ps = clock_time_ps + drawTileLayer(layer_base);
-                    break;
-                case LAYER_TYPE_8BPP :
-                    next_action_time_ps = clock_time_ps + drawBppBitmap(layer_base);
-                    break;
-                case LAYER_TYPE_4BPP : 
-                    next_action_time_ps = clock_time_ps + draw4ppBitmap(layer_base);
-                    break;
-            }
+            next_action_time_ps = clock_time_ps + drawLayer(layer_base);
         }
 
         if( debug_layers ) {
@@ -386,38 +1058,361 @@ uint64_t VideoBeast::tick(uint64_t clock_time_ps) {
 
         if( currentLayer == MAX_LAYERS) {
             currentLayer = IDLE;
+            recordLineTime(next_action_time_ps - lineStart_ps);
         }
     }
 
     if( next_action_time_ps <= clock_time_ps || next_line_time_ps <= clock_time_ps ) {
-        std::cout << "VideoBeast clock sync error" << std::endl;
+        frameTiming.clockSyncErrors++;
         next_line_time_ps = clock_time_ps + VIDEO_MODE[mode].totalWidth * VIDEO_MODE[mode].pixel_clock_ps;
         next_action_time_ps = next_line_time_ps;
 
         return next_line_time_ps;
     }
 
-    if( next_action_time_ps > next_line_time_ps ) {
-        std::cout << "Videobeast scan time exceeded on line " << currentLine << std::endl;
-    }
-
     if( next_line_time_ps <= clock_time_ps ) {
-        std::cout << "Line time sync error" << std::endl;
+        frameTiming.lineSyncErrors++;
     }
 
     return std::min( next_action_time_ps, next_line_time_ps );
 }
 
+void VideoBeast::TimingStats::add(const TimingStats &other) {
+    frames += other.frames;
+    lines += other.lines;
+    overrunLines += other.overrunLines;
+    clockSyncErrors += other.clockSyncErrors;
+    lineSyncErrors += other.lineSyncErrors;
+    worstLinePercent = std::max(worstLinePercent, other.worstLinePercent);
+    linePeriod_ps = other.linePeriod_ps;
+    for( int i=0; i<TIMING_BUCKETS; i++ ) {
+        histogram[i] += other.histogram[i];
+    }
+}
+
+void VideoBeast::recordLineTime(uint64_t time_ps) {
+    uint64_t linePeriod_ps = VIDEO_MODE[mode].totalWidth * VIDEO_MODE[mode].pixel_clock_ps;
+    uint64_t bucket = std::min((uint64_t)TIMING_BUCKETS-1, time_ps * 8 / linePeriod_ps);
+
+    frameTiming.lines++;
+    frameTiming.histogram[bucket]++;
+    frameTiming.worstLinePercent = std::max(frameTiming.worstLinePercent, (uint32_t)(time_ps * 100 / linePeriod_ps));
+    lineOverrun = time_ps > linePeriod_ps;
+    if( lineOverrun ) {
+        frameTiming.overrunLines++;
+    }
+}
+
+void VideoBeast::endFrameTiming() {
+    frameTiming.frames = 1;
+    frameTiming.linePeriod_ps = VIDEO_MODE[mode].totalWidth * VIDEO_MODE[mode].pixel_clock_ps;
+    lastFrameTiming = frameTiming;
+    totalTiming.add(frameTiming);
+    warningTiming.add(frameTiming);
+    frameTiming = TimingStats();
+    {
+        std::lock_guard<std::mutex> lock(statsLock);
+        statsLastFrame = lastFrameTiming;
+        statsTotal = totalTiming;
+    }
+
+    if( warningTiming.frames >= WARNING_INTERVAL_FRAMES ) {
+        if( warningTiming.overrunLines > 0 ) {
+            std::cout << "VideoBeast: " << warningTiming.overrunLines << " lines took longer to render than the line period in the last "
+                      << warningTiming.frames << " frames (worst " << warningTiming.worstLinePercent << "%)" << std::endl;
+        }
+        if( warningTiming.clockSyncErrors > 0 || warningTiming.lineSyncErrors > 0 ) {
+            std::cout << "VideoBeast: " << warningTiming.clockSyncErrors << " clock sync errors and " << warningTiming.lineSyncErrors
+                      << " line time sync errors in the last " << warningTiming.frames << " frames" << std::endl;
+        }
+        warningTiming = TimingStats();
+    }
+}
+
+// For debug_layers, mark lines whose layers ran over the line period in red at the right hand side, and draw
+// the last frame's histogram of line times in the top left corner, with the buckets over the line period in red
+void VideoBeast::drawTimingOverlay(int row, int width) {
+    static const int BAR_WIDTH = 6;
+    static const int HISTOGRAM_HEIGHT = 64;
+    static const int OVERRUN_MARK_WIDTH = 8;
+
+    if( row < 0 ) {
+        return;
+    }
+    if( lineOverrun || currentLayer != IDLE ) {
+        for( int i=std::max(0, width-OVERRUN_MARK_WIDTH); i<width; i++ ) {
+            line_buffer[i] = 0xFFFF0000;
+        }
+    }
+    if( row < HISTOGRAM_HEIGHT && lastFrameTiming.lines > 0 ) {
+        for( int bucket=0; bucket<TIMING_BUCKETS; bucket++ ) {
+            // Bar heights are the share of the frame's lines in each bucket, rounded up so no bucket is lost
+            uint64_t height = (lastFrameTiming.histogram[bucket] * HISTOGRAM_HEIGHT + lastFrameTiming.lines - 1) / lastFrameTiming.lines;
+            uint32_t colour = 0xFF000000;
+            if( (uint64_t)(HISTOGRAM_HEIGHT - row) <= height ) {
+                colour = bucket < 8 ? 0xFFFFFFFF : 0xFFFF0000;
+            }
+            for( int i=0; i<BAR_WIDTH-1 && bucket*BAR_WIDTH+i < width; i++ ) {
+                line_buffer[bucket*BAR_WIDTH + i] = colour;
+            }
+        }
+    }
+}
+
+void VideoBeast::recordWrite(const JournalEntry &entry) {
+    if( frameWrites.size() >= MAX_WRITE_RECORDS ) {
+        frameWritesDropped++;
+        return;
+    }
+    const VideoMode &videoMode = VIDEO_MODE[mode];
+    uint64_t lineStart_ps = next_line_time_ps - videoMode.totalWidth * videoMode.pixel_clock_ps;
+    uint64_t offset_ps = entry.time_ps > lineStart_ps ? entry.time_ps - lineStart_ps : 0;
+    uint16_t pixel = std::min(offset_ps / videoMode.pixel_clock_ps, (uint64_t)videoMode.totalWidth - 1);
+    bool racing = currentLayer != IDLE && displayLine < videoMode.pixelHeight;
+
+    frameWrites.push_back(WriteRecord{entry.index, displayLine, pixel, currentLayer, entry.target, entry.data, racing});
+}
+
+// Mark the frame's writes where the raster was when they landed: racing writes in red, then VRAM green,
+// registers yellow, palettes magenta and sprites cyan. Marked rows are drawn again in the next frame.
+void VideoBeast::drawWriteMarkers() {
+    static const int MARKER_WIDTH = 3;
+    const VideoMode &videoMode = VIDEO_MODE[mode];
+    uint64_t *signatures = row_signature[frame_buffer == frame_buffers[0] ? 0 : 1];
+
+    for( const WriteRecord &record : frameWrites ) {
+        if( record.displayLine >= videoMode.pixelHeight ) {
+            continue;
+        }
+        uint32_t colour = 0xFFFF0000;
+        if( !record.racing ) {
+            switch( record.target ) {
+                case JOURNAL_MEM :       colour = 0xFF00FF00; break;
+                case JOURNAL_REGISTER :  colour = 0xFFFFFF00; break;
+                case JOURNAL_PALETTE_1 :
+                case JOURNAL_PALETTE_2 : colour = 0xFFFF00FF; break;
+                case JOURNAL_SPRITE :    colour = 0xFF00FFFF; break;
+            }
+        }
+        int x = record.pixel * videoMode.pixelWidth / videoMode.totalWidth;
+        uint32_t *row = frame_buffer + record.displayLine * MAX_LINE_WIDTH;
+        for( int i=x; i<x+MARKER_WIDTH && i<videoMode.pixelWidth; i++ ) {
+            row[i] = colour;
+        }
+        signatures[record.displayLine] = 0;
+    }
+}
+
+void VideoBeast::endFrameWrites() {
+    if( frameWrites.empty() && frameWritesDropped == 0 ) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(writesLock);
+        lastFrameWrites.swap(frameWrites);
+        lastFrameWritesDropped = frameWritesDropped;
+        lastFrameWritesNumber = frameCount;
+    }
+    frameWrites.clear();
+    frameWritesDropped = 0;
+}
+
+void VideoBeast::exportWrites() {
+    static const char *TARGET_NAMES[] = {"vram", "register", "palette1", "palette2", "sprite"};
+
+    std::lock_guard<std::mutex> lock(writesLock);
+    if( lastFrameWrites.empty() ) {
+        std::cout << "No VideoBeast writes recorded. Press W in the VideoBeast window to record them" << std::endl;
+        return;
+    }
+    std::ofstream out(WRITES_FILENAME);
+    if( !out ) {
+        std::cout << "Could not create " << WRITES_FILENAME << std::endl;
+        return;
+    }
+
+    int racing = 0;
+    out << "frame,line,pixel,layer,target,index,data,racing" << std::endl;
+    for( const WriteRecord &record : lastFrameWrites ) {
+        out << lastFrameWritesNumber << "," << record.displayLine << "," << record.pixel << ",";
+        if( record.layer == IDLE ) {
+            out << "idle";
+        }
+        else {
+            out << (int)record.layer;
+        }
+        out << "," << TARGET_NAMES[record.target] << "," << record.index << "," << (int)record.data << "," << (record.racing ? 1 : 0) << std::endl;
+        racing += record.racing ? 1 : 0;
+    }
+
+    std::cout << "Wrote " << lastFrameWrites.size() << " VideoBeast writes from frame " << lastFrameWritesNumber << " to " << WRITES_FILENAME
+              << ", " << racing << " racing the renderer";
+    if( lastFrameWritesDropped > 0 ) {
+        std::cout << " (" << lastFrameWritesDropped << " more not recorded)";
+    }
+    std::cout << std::endl;
+}
+
+void VideoBeast::printStats() {
+    TimingStats lastFrame, total;
+    {
+        std::lock_guard<std::mutex> lock(statsLock);
+        lastFrame = statsLastFrame;
+        total = statsTotal;
+    }
+
+    std::cout << "VideoBeast render timing, for the last frame and all " << total.frames << " frames" << std::endl;
+    std::cout << "  Line period          " << lastFrame.linePeriod_ps / RENDER_CLOCK_PS << " render clocks" << std::endl;
+    std::cout << "  Lines                " << std::setw(8) << lastFrame.lines << std::setw(12) << total.lines << std::endl;
+    std::cout << "  Lines over time      " << std::setw(8) << lastFrame.overrunLines << std::setw(12) << total.overrunLines << std::endl;
+    std::cout << "  Worst line (%)       " << std::setw(8) << lastFrame.worstLinePercent << std::setw(12) << total.worstLinePercent << std::endl;
+    std::cout << "  Clock sync errors    " << std::setw(8) << lastFrame.clockSyncErrors << std::setw(12) << total.clockSyncErrors << std::endl;
+    std::cout << "  Line sync errors     " << std::setw(8) << lastFrame.lineSyncErrors << std::setw(12) << total.lineSyncErrors << std::endl;
+    std::cout << "  Line times, as a share of the line period" << std::endl;
+    for( int bucket=0; bucket<TIMING_BUCKETS; bucket++ ) {
+        std::cout << "    " << std::setw(4) << (bucket * 100 / 8) << "% ";
+        if( bucket < TIMING_BUCKETS-1 ) {
+            std::cout << "- " << std::setw(3) << ((bucket+1) * 100 / 8) << "%   ";
+        }
+        else {
+            std::cout << "and over ";
+        }
+        std::cout << std::setw(8) << lastFrame.histogram[bucket] << std::setw(12) << total.histogram[bucket] << std::endl;
+    }
+}
+
+// Start any frames due by the given time, latching the mode they are drawn in
+void VideoBeast::advanceRaster(uint64_t time_ps) {
+    while( rasterNextFrame_ps <= time_ps ) {
+        rasterStarted = true;
+        rasterFrameStart_ps = rasterNextFrame_ps;
+        rasterFirstLine_ps = rasterLine_ps;
+        rasterMode = std::min(host_registers[REG_MODE] & 0x07, VIDEO_MODES-1);
+        rasterDoubled = (host_registers[REG_MODE] & 0x08) != 0;
+        rasterLine_ps = VIDEO_MODE[rasterMode].totalWidth * VIDEO_MODE[rasterMode].pixel_clock_ps;
+        rasterNextFrame_ps = rasterFrameStart_ps + rasterFirstLine_ps + (VIDEO_MODE[rasterMode].totalHeight - 1) * rasterLine_ps;
+    }
+}
+
+uint64_t VideoBeast::lineStart(int displayLine) {
+    if( displayLine == 0 ) {
+        return rasterFrameStart_ps;
+    }
+    return rasterFrameStart_ps + rasterFirstLine_ps + (displayLine - 1) * rasterLine_ps;
+}
+
+// The line the renderer would report at this time. It steps on the CPU's clock after the CPU's own access,
+// so a line that starts on this cycle isn't seen yet.
+uint16_t VideoBeast::rasterLine(uint64_t clock_time_ps) {
+    uint64_t time_ps = clock_time_ps - clock_cycle_ps;
+    raiseInterrupts(time_ps);
+    advanceRaster(time_ps);
+    if( !rasterStarted ) {
+        return 0;
+    }
+
+    int displayLine = 0;
+    if( time_ps >= rasterFrameStart_ps + rasterFirstLine_ps ) {
+        displayLine = 1 + (time_ps - rasterFrameStart_ps - rasterFirstLine_ps) / rasterLine_ps;
+    }
+    return rasterDoubled ? displayLine / 2 : displayLine;
+}
+
+// Display line an interrupt source is raised at in the current frame, or -1 if it isn't
+int VideoBeast::interruptLine(uint8_t source) {
+    if( source == INT_VBLANK ) {
+        return VIDEO_MODE[rasterMode].pixelHeight;
+    }
+    int line = host_registers[REG_INT_LINE_L] | (host_registers[REG_INT_LINE_H] << 8);
+    if( rasterDoubled ) {
+        line *= 2;
+    }
+    return line < VIDEO_MODE[rasterMode].totalHeight ? line : -1;
+}
+
+void VideoBeast::raiseInterrupts(uint64_t clock_time_ps) {
+    while( nextInterrupt_ps <= clock_time_ps ) {
+        uint64_t time_ps = nextInterrupt_ps;
+        advanceRaster(time_ps);
+        for( uint8_t source = INT_VBLANK; source <= INT_LINE && rasterStarted; source <<= 1 ) {
+            int line = interruptLine(source);
+            if( line >= 0 && alignToCycle(lineStart(line)) == time_ps ) {
+                host_registers[REG_INT_STATUS] |= source;
+            }
+        }
+        nextInterrupt_ps = nextInterruptAfter(time_ps);
+    }
+}
+
+// The next time after the given one that an interrupt could be raised, or the next frame starts
+uint64_t VideoBeast::nextInterruptAfter(uint64_t clock_time_ps) {
+    advanceRaster(clock_time_ps);
+    uint64_t next_ps = alignToCycle(rasterNextFrame_ps);
+    for( uint8_t source = INT_VBLANK; source <= INT_LINE && rasterStarted; source <<= 1 ) {
+        int line = interruptLine(source);
+        if( line >= 0 ) {
+            uint64_t time_ps = alignToCycle(lineStart(line));
+            if( time_ps > clock_time_ps && time_ps < next_ps ) {
+                next_ps = time_ps;
+            }
+        }
+    }
+    return next_ps;
+}
+
+// The interrupt registers belong to the CPU side, so they aren't journaled
+void VideoBeast::writeInterruptRegister(uint8_t reg, uint8_t data, uint64_t clock_time_ps) {
+    // Anything due before this cycle is raised with the old settings
+    uint64_t before_ps = clock_time_ps - clock_cycle_ps;
+    raiseInterrupts(before_ps);
+
+    if( reg == REG_INT_STATUS ) {
+        host_registers[REG_INT_STATUS] &= ~data;
+    }
+    else {
+        host_registers[reg] = data;
+    }
+    nextInterrupt_ps = nextInterruptAfter(before_ps);
+}
+
+uint8_t VideoBeast::interruptVector() {
+    uint8_t active = host_registers[REG_INT_STATUS] & host_registers[REG_INT_ENABLE];
+    // Vertical blank takes priority over line compare
+    return (host_registers[REG_INT_VECTOR] & 0xFC) | ((active & INT_VBLANK) ? 0 : 2);
+}
+
+void VideoBeast::writeMem(uint32_t address, uint8_t data, uint64_t clock_time_ps) {
+    host_mem[address] = data;
+    publish(JOURNAL_MEM, address, data, clock_time_ps);
+}
+
 void VideoBeast::write(uint16_t addr, uint8_t data, uint64_t clock_time_ps) {
     if( (addr & 0x3FFE) == 0x3FFE ) {
         // Top two registers, always visible
-        registers[addr & 0xFF] = data;
+        if( (addr & 0xFF) == REG_MODE ) {
+            // Frames that have already started keep the mode they started with
+            raiseInterrupts(clock_time_ps - clock_cycle_ps);
+            advanceRaster(clock_time_ps - clock_cycle_ps);
+        }
+        host_registers[addr & 0xFF] = data;
+        publish(JOURNAL_REGISTER, addr & 0xFF, data, clock_time_ps);
+
+        if( (addr & 0xFF) == REG_MODE ) {
+            buildWindowMap();
+        }
     }
-    else if( (addr & 0x3F00) == 0x3F00 && registers[REG_LOCKED] == SET_UNLOCKED ) {
+    else if( (addr & 0x3F00) == 0x3F00 && host_registers[REG_LOCKED] == SET_UNLOCKED ) {
         // Register access
-        if( (addr & 0xFF) >= 0x80 ) {
-            registers[addr & 0xFF] = data;
+        if( (addr & 0xFF) >= REG_INT_ENABLE && (addr & 0xFF) <= REG_INT_VECTOR ) {
+            writeInterruptRegister(addr & 0xFF, data, clock_time_ps);
+        }
+        else if( (addr & 0xFF) >= 0x80 ) {
+            host_registers[addr & 0xFF] = data;
+            publish(JOURNAL_REGISTER, addr & 0xFF, data, clock_time_ps);
 
+            if( (addr & 0xFF) >= REG_PAGE_3 && (addr & 0xFF) <= REG_PAGE_0 ) {
+                buildWindowMap();
+            }
             if ( (addr & 0x0FF) == REG_MULT_X_L ||
                  (addr & 0x0FF) == REG_MULT_X_H ||
                  (addr & 0x0FF) == REG_MULT_Y_L ||
@@ -425,192 +1420,169 @@ void VideoBeast::write(uint16_t addr, uint8_t data, uint64_t clock_time_ps) {
                 next_multiply_available_ps = clock_time_ps + 12 * RENDER_CLOCK_PS;
             }
         }
-        else if( (registers[REG_LOWER_REG] & 0x10) == 0 ) {
+        else if( (host_registers[REG_LOWER_REG] & 0x10) == 0 ) {
             // Palettes
-            int idx = ((registers[REG_LOWER_REG] & 0x03) << 6) | ((addr & 0x7F) >> 1);
+            int idx = ((host_registers[REG_LOWER_REG] & 0x03) << 6) | ((addr & 0x7F) >> 1);
 
-            if( (registers[REG_LOWER_REG] & 0x04) == 0 ) {
+            if( (host_registers[REG_LOWER_REG] & 0x04) == 0 ) {
                 // Palette 1
-                uint16_t val = paletteReg1[idx];
+                uint16_t val = host_paletteReg1[idx];
 
                 if ((addr & 0x01) == 0) {
-                    paletteReg1[idx] = (val & 0xFF00) | data;
+                    host_paletteReg1[idx] = (val & 0xFF00) | data;
                 }
                 else {
-                    paletteReg1[idx] = (val & 0x0FF) | (data <<8);
+                    host_paletteReg1[idx] = (val & 0x0FF) | (data <<8);
                 }
-                palette1[idx] = getColour(paletteReg1[idx]);
+                publish(JOURNAL_PALETTE_1, (idx << 1) | (addr & 0x01), data, clock_time_ps);
             }
             else {
                 // Palette 2
-                uint16_t val = paletteReg2[idx];
+                uint16_t val = host_paletteReg2[idx];
 
                 if ((addr & 0x01) == 0) {
-                    paletteReg2[idx] = (val & 0xFF00) | data;
+                    host_paletteReg2[idx] = (val & 0xFF00) | data;
                 }
                 else {
-                    paletteReg2[idx] = (val & 0x0FF) | (data <<8);
+                    host_paletteReg2[idx] = (val & 0x0FF) | (data <<8);
                 }
-                palette2[idx] = getColour(paletteReg2[idx]);
+                publish(JOURNAL_PALETTE_2, (idx << 1) | (addr & 0x01), data, clock_time_ps);
             }
         }
         else {
             // Sprites
-            // TODO
+            int idx = ((host_registers[REG_LOWER_REG] & 0x0F) << 7) | (addr & 0x7F);
+            host_sprites[idx] = data;
+            publish(JOURNAL_SPRITE, idx, data, clock_time_ps);
         }
     }
     else {
         // Ram access
-        switch( registers[REG_MODE] >> 5) {
-            case 0 : 
-                mem[ (registers[REG_PAGE_0] << 12) + (addr & 0x3FFF) ] = data;
-                break;
-            case 1 :
-                if ((addr & 0x2000) == 0) { 
-                    mem[ (registers[REG_PAGE_0] << 12 ) + (addr & 0x1FFF)] = data;
-                }
-                else {
-                    mem[ (registers[REG_PAGE_1] << 12 ) + (addr & 0x1FFF)] = data;
-                }
-                break;
-            case 2 :
-                switch ((addr >> 12) & 0x03 ) {
-                    case 0 : mem[ (registers[REG_PAGE_0] << 11 ) + (addr & 0x0FFF)] = data; break;
-                    case 1 : mem[ (registers[REG_PAGE_1] << 11 ) + (addr & 0x0FFF)] = data; break;
-                    case 2 : mem[ (registers[REG_PAGE_2] << 11 ) + (addr & 0x0FFF)] = data; break;
-                    case 3 : mem[ (registers[REG_PAGE_3] << 11 ) + (addr & 0x0FFF)] = data; break;
-                    default:
-                        std::cout << "VideoBeast 4K low page write error";
-                }
-                
-            case 3 :
-                switch ((addr >> 12) & 0x03 ) {
-                    case 0 : mem[ 0x80000 | ((registers[REG_PAGE_0] << 11 ) + (addr & 0x0FFF))] = data; break;
-                    case 1 : mem[ 0x80000 | ((registers[REG_PAGE_1] << 11 ) + (addr & 0x0FFF))] = data; break;
-                    case 2 : mem[ 0x80000 | ((registers[REG_PAGE_2] << 11 ) + (addr & 0x0FFF))] = data; break;
-                    case 3 : mem[ 0x80000 | ((registers[REG_PAGE_3] << 11 ) + (addr & 0x0FFF))] = data; break;
-                    default:
-                        std::cout << "VideoBeast 4K high page write error";
-                }
-            case 4:
-                mem[getSinclairAddress(addr)] = data;
-                break;
-            default:
-                std::cout << "Videobeast unknown page map mode " << (registers[REG_MODE] >> 5) << std::endl;
-
-        } 
+        uint32_t base = windowMap[(addr & 0x3FFF) >> WINDOW_SLICE_BITS];
+        if( base != UNMAPPED ) {
+            writeMem(base + (addr & (WINDOW_SLICE-1)), data, clock_time_ps);
+        }
     }
 }
 
 uint8_t VideoBeast::read(uint16_t addr, uint64_t clock_time_ps) {
     if( (addr & 0x3FFE) == 0x3FFE ) {
         // Top two registers, always visible
-        return registers[addr & 0xFF];
+        return host_registers[addr & 0xFF];
     }
-    else if( (addr & 0x3F00) == 0x3F00 && registers[REG_LOCKED] == SET_UNLOCKED ) {
+    else if( (addr & 0x3F00) == 0x3F00 && host_registers[REG_LOCKED] == SET_UNLOCKED ) {
         // Register access
         if( (addr & 0xFF) >= 0x80 ) {
-            registers[REG_CURRENT_LINE_L] = currentLine & 0x0FF;
-            registers[REG_CURRENT_LINE_H] = currentLine >> 8;
+            if( (addr & 0xFF) == REG_CURRENT_LINE_L || (addr & 0xFF) == REG_CURRENT_LINE_H ) {
+                // The only read that depends on the raster, which the CPU side keeps time with
+                uint16_t line = rasterLine(clock_time_ps);
+                host_registers[REG_CURRENT_LINE_L] = line & 0x0FF;
+                host_registers[REG_CURRENT_LINE_H] = line >> 8;
+            }
 
             if( next_multiply_available_ps != 0 && next_multiply_available_ps <= clock_time_ps ) {
-                int32_t mult_x = ((registers[REG_MULT_X_L] | (registers[REG_MULT_X_H] << 8)) << 16) >> 16;
-                int32_t mult_y = ((registers[REG_MULT_Y_L] | (registers[REG_MULT_Y_H] << 8)) << 16) >> 16;
+                int32_t mult_x = ((host_registers[REG_MULT_X_L] | (host_registers[REG_MULT_X_H] << 8)) << 16) >> 16;
+                int32_t mult_y = ((host_registers[REG_MULT_Y_L] | (host_registers[REG_MULT_Y_H] << 8)) << 16) >> 16;
 
                 int32_t product = mult_x * mult_y;
-                registers[REG_PRODUCT_B0] = product & 0x0FF;
-                registers[REG_PRODUCT_B1] = (product >>  8) & 0x0FF;
-                registers[REG_PRODUCT_B2] = (product >> 16) & 0x0FF;
-                registers[REG_PRODUCT_B3] = (product >> 24) & 0x0FF;
+                host_registers[REG_PRODUCT_B0] = product & 0x0FF;
+                host_registers[REG_PRODUCT_B1] = (product >>  8) & 0x0FF;
+                host_registers[REG_PRODUCT_B2] = (product >> 16) & 0x0FF;
+                host_registers[REG_PRODUCT_B3] = (product >> 24) & 0x0FF;
 
                 next_multiply_available_ps = 0;
             }
-            return registers[addr & 0xFF];
+            return host_registers[addr & 0xFF];
         }
-        if( (registers[REG_LOWER_REG] & 0x10) == 0 ) {
+        if( (host_registers[REG_LOWER_REG] & 0x10) == 0 ) {
             // Palettes
-            if( (registers[REG_LOWER_REG] & 0x04) == 0 ) {
+            if( (host_registers[REG_LOWER_REG] & 0x04) == 0 ) {
                 // Palette 1
-                uint16_t val = paletteReg1[ ((registers[REG_LOWER_REG] & 0x03) << 6) | ((addr & 0x7F) >> 1)];
+                uint16_t val = host_paletteReg1[ ((host_registers[REG_LOWER_REG] & 0x03) << 6) | ((addr & 0x7F) >> 1)];
 
                 return ((addr & 0x01) == 0) ? val & 0x0FF : val >> 8;
             }
             else {
                 // Palette 2
-                uint16_t val = paletteReg2[ ((registers[REG_LOWER_REG] & 0x03) << 6) | ((addr & 0x7F) >> 1)];
+                uint16_t val = host_paletteReg2[ ((host_registers[REG_LOWER_REG] & 0x03) << 6) | ((addr & 0x7F) >> 1)];
 
                 return ((addr & 0x01) == 0) ? val & 0x0FF : val >> 8;
             }
         }
         else {
             // Sprites
-            return 0;
+            return host_sprites[((host_registers[REG_LOWER_REG] & 0x0F) << 7) | (addr & 0x7F)];
         }
     }
     else {
         // Ram access
-        switch( registers[REG_MODE] >> 5) {
-            case 0 : 
-                return mem[ (registers[REG_PAGE_0] << 12) + (addr & 0x3FFF) ];
-            case 1 :
-                return ((addr & 0x2000) == 0) ? 
-                    mem[ (registers[REG_PAGE_0] << 12 ) + (addr & 0x1FFF)] :
-                    mem[ (registers[REG_PAGE_1] << 12 ) + (addr & 0x1FFF)];
-            case 2 :
-                switch ((addr >> 12) & 0x03 ) {
-                    case 0 : return mem[ (registers[REG_PAGE_0] << 11 ) + (addr & 0x0FFF)];
-                    case 1 : return mem[ (registers[REG_PAGE_1] << 11 ) + (addr & 0x0FFF)];
-                    case 2 : return mem[ (registers[REG_PAGE_2] << 11 ) + (addr & 0x0FFF)];
-                    case 3 : return mem[ (registers[REG_PAGE_3] << 11 ) + (addr & 0x0FFF)];
-                    default:
-                        std::cout << "VideoBeast 4K low page error";
-                        return 0;
-                }
-                
-            case 3 :
-                switch ((addr >> 12) & 0x03 ) {
-                    case 0 : return mem[ 0x80000 | ((registers[REG_PAGE_0] << 11 ) + (addr & 0x0FFF))];
-                    case 1 : return mem[ 0x80000 | ((registers[REG_PAGE_1] << 11 ) + (addr & 0x0FFF))];
-                    case 2 : return mem[ 0x80000 | ((registers[REG_PAGE_2] << 11 ) + (addr & 0x0FFF))];
-                    case 3 : return mem[ 0x80000 | ((registers[REG_PAGE_3] << 11 ) + (addr & 0x0FFF))];
-                    default:
-                        std::cout << "VideoBeast 4K high page error";
-                        return 0;
-                }
-            case 4:
-                return mem[getSinclairAddress(addr)];
-            default:
-                std::cout << "Videobeast unknown page map mode " << (registers[REG_MODE] >> 5) << std::endl;
-
-        } 
+        uint32_t base = windowMap[(addr & 0x3FFF) >> WINDOW_SLICE_BITS];
+        if( base != UNMAPPED ) {
+            return host_mem[base + (addr & (WINDOW_SLICE-1))];
+        }
     }
 
     return 0;
 }
 
+// Work out where each slice of the 16K host window lands in video RAM, for the current page map mode
+void VideoBeast::buildWindowMap() {
+    int pageMode = host_registers[REG_MODE] >> 5;
+    if( pageMode > 4 ) {
+        std::cout << "Videobeast unknown page map mode " << pageMode << std::endl;
+    }
+
+    for( int slice=0; slice<WINDOW_SLICES; slice++ ) {
+        uint16_t addr = slice << WINDOW_SLICE_BITS;
+        uint32_t base;
+
+        switch( pageMode ) {
+            case 0 :    // One 16K window in 4K steps
+                base = (host_registers[REG_PAGE_0] << 12) + addr;
+                break;
+            case 1 :    // Two 8K windows in 4K steps
+                base = (host_registers[(addr & 0x2000) ? REG_PAGE_1 : REG_PAGE_0] << 12) + (addr & 0x1FFF);
+                break;
+            case 2 :    // Four 4K windows in 2K steps, in the low 512K
+            case 3 :    // Four 4K windows in 2K steps, in the high 512K
+                base = (host_registers[REG_PAGE_0 - ((addr >> 12) & 0x03)] << 11) + (addr & 0x0FFF);
+                if( pageMode == 3 ) {
+                    base |= 0x80000;
+                }
+                break;
+            case 4 :
+                base = getSinclairAddress(addr);
+                break;
+            default :
+                base = UNMAPPED;
+        }
+        windowMap[slice] = (base == UNMAPPED) ? UNMAPPED : (base & (VIDEO_RAM_LENGTH-1));
+    }
+}
+
 uint32_t VideoBeast::getSinclairAddress(uint16_t addr) {
     addr = addr & 0x3FFF;
     if( addr < 0x1800 ) {
         // Spectrum bitmap
-        return ((registers[REG_PAGE_1] & 0x3F) << 14) + 
-               ((registers[REG_PAGE_2] & 0x04) << 11) +
-               ((addr & 0x1800)) +                         // Y7:6   -> Bits 14-13
-               ((addr & 0xE0  ) << 4) +                    // Y5:3   -> Bits 12-10
+        return ((host_registers[REG_PAGE_1] & 0x3F) << 14) + 
+               ((host_registers[REG_PAGE_2] & 0x04) << 13) +     //        -> Bit 15
+               ((addr & 0x1800) << 2) +                    // Y7:6   -> Bits 14-13
+               ((addr & 0xE0  ) << 5) +                    // Y5:3   -> Bits 12-10
                ((addr & 0x700 ) >> 1) +                    // Y2:0   -> Bits 9-7
-               ((registers[REG_PAGE_2] & 0x03) << 5) +     //        -> Bits 6-5
+               ((host_registers[REG_PAGE_2] & 0x03) << 5) +     //        -> Bits 6-5
                ((addr & 0x1F  ));                          // X4:0   -> Bits 0-4          
     } 
     else if( addr < 0x1B00 ) {
         // Spectrum attributes
-        return ((registers[REG_PAGE_0] & 0x3F) << 14) + 
-               ((registers[REG_PAGE_2] & 0x04) << 10) +
+        return ((host_registers[REG_PAGE_0] & 0x3F) << 14) + 
+               ((host_registers[REG_PAGE_2] & 0x04) << 10) +
                ((addr & 0x3E0 ) << 2 ) +                   // Y4:0   -> Bits 11-7
-               ((registers[REG_PAGE_2] & 0x03) << 5) +     //        -> Bits 6-5
+               ((host_registers[REG_PAGE_2] & 0x03) << 5) +     //        -> Bits 6-5
                ((addr & 0x1F  ));                          // X4:0   -> Bits 0-4     
     }
     else {
         // General ram
-        return ((registers[REG_PAGE_3] & 0x3F) << 14) + addr;
+        return ((host_registers[REG_PAGE_3] & 0x3F) << 14) + addr;
     }
 }
 
@@ -647,42 +1619,40 @@ void VideoBeast::createWindow() {
     }
 
     windowID = SDL_GetWindowID( window );
-    checkWindow(width, height);
-}
-
-void VideoBeast::updateMode() {
-    int width = VIDEO_MODE[mode].pixelWidth * requestedZoom;
-    int height = VIDEO_MODE[mode].pixelHeight * requestedZoom;
 
-    SDL_SetWindowSize(window, width, height);
+    // Scaling to the window (including any fractional zoom or high DPI) is left to the renderer
+    renderer = SDL_CreateRenderer(window, -1, 0);
+    if( NULL == renderer ) {
+        std::cout << "Could not create VideoBeast renderer: " << SDL_GetError() << std::endl;
+        exit(1);
+    }
 
-    checkWindow(width, height);
+    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, MAX_LINE_WIDTH, MAX_LINES);
+    if( NULL == texture ) {
+        std::cout << "Could not create VideoBeast texture: " << SDL_GetError() << std::endl;
+        exit(1);
+    }
 }
 
-void VideoBeast::checkWindow(int width, int height) {
-    surface = SDL_GetWindowSurface(window);
-    zoom = requestedZoom;
+void VideoBeast::updateMode(int windowMode) {
+    int width = VIDEO_MODE[windowMode].pixelWidth * requestedZoom;
+    int height = VIDEO_MODE[windowMode].pixelHeight * requestedZoom;
 
-    if(surface->w != width) {
-        float widthScale = (float)surface->w / (float) (width);
-        float heightScale = (float)surface->h / (float) (height);
+    SDL_SetWindowSize(window, width, height);
+}
 
-        if(widthScale != heightScale) {
-            std::cerr << "WARNING: width scale != height scale" << std::endl;
-        }
+void VideoBeast::presentFrame(const uint32_t *buffer, int frameMode) {
+    SDL_Rect source = {0, 0, VIDEO_MODE[frameMode].pixelWidth, VIDEO_MODE[frameMode].pixelHeight};
 
-        zoom *= widthScale;
-    }
+    SDL_UpdateTexture(texture, &source, buffer, MAX_LINE_WIDTH * sizeof(uint32_t));
+    SDL_RenderCopy(renderer, texture, &source, NULL);
+    SDL_RenderPresent(renderer);
 }
 
 void VideoBeast::clearWindow() {
-    uint32_t dest = 0;
-    
-    for( int y=0; y < surface->h; y++ ) {
-        for(int x=0; x<surface->w; x++) {
-            *(Uint32 *)((uint8_t*)surface->pixels+dest) = background;
-            dest += surface->format->BytesPerPixel;
-        }
+    for( int i=0; i<MAX_LINE_WIDTH * MAX_LINES; i++ ) {
+        frame_buffers[0][i] = background;
+        frame_buffers[1][i] = background;
     }
-    SDL_UpdateWindowSurface(window);
+    presentFrame(frame_buffer, mode);
 }
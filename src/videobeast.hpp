@@ -1,7 +1,13 @@
 #pragma once
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
 #include <set>
+#include <thread>
 #include <vector>
 #include "SDL.h"
+#include "capture.hpp"
+#include "scanline.hpp"
 
 class VideoBeast {
 
@@ -17,6 +23,12 @@ class VideoBeast {
     static const int PALETTE_LENGTH   = 256;
 
     static const int MAX_LINE_WIDTH   = 1024;
+    static const int MAX_LINES        = 480;
+
+    static const int MAX_SPRITES          = 256;
+    static const int SPRITE_BYTES         = 8;
+    static const int SPRITE_RAM_LENGTH    = MAX_SPRITES * SPRITE_BYTES;
+    static const int MAX_SPRITES_PER_LINE = 32;
 
     static const uint64_t RENDER_CLOCK_PS = 14814ULL;
 
@@ -33,6 +45,14 @@ class VideoBeast {
     static const int REG_PAGE_2         = 0xF7;
     static const int REG_PAGE_3         = 0xF6;
     static const int REG_LOWER_REG      = 0xF5;
+    static const int REG_INT_VECTOR     = 0xF4;    // Interrupt mode 2 vector. Line compare adds 2
+    static const int REG_INT_LINE_H     = 0xF3;    // Line compare, counted as REG_CURRENT_LINE
+    static const int REG_INT_LINE_L     = 0xF2;
+    static const int REG_INT_STATUS     = 0xF1;    // Raised interrupts. Write 1s to clear them
+    static const int REG_INT_ENABLE     = 0xF0;
+
+    static const uint8_t INT_VBLANK     = 0x01;    // Start of the first line below the display
+    static const uint8_t INT_LINE       = 0x02;    // Start of the line set in REG_INT_LINE
 
     static const int REG_MULT_X_L       = 0xE0;
     static const int REG_MULT_X_H       = 0xE1;
@@ -66,12 +86,30 @@ class VideoBeast {
     static const int REG_OFF_TEXT_PALETTE = 10; // [3:0] - Palette index, [4] - 0: Normal palette. 1: Sinclair palette
     static const int REG_OFF_TEXT_BITMAP  = 11; // 1bpp Bitmap base / 16K   (0 disables)
 
+    // Text layer attribute decoding
+    static const int ATTRIBUTES_NORMAL   = 0;
+    static const int ATTRIBUTES_SINCLAIR = 1;   // Add 1 while flashing attributes are inverted
+    static const int ATTRIBUTE_TABLES    = 3;
+    static const int FLASH_FRAMES        = 16;
+
     static const int REG_OFF_TILE_MAP     = 8;  // Tile map base / 16K
     static const int REG_OFF_TILE_GRAPHIC = 9;  // Graphics base / 32K
 
     static const int REG_OFF_BITMAP_BASE    = 8;  // Bitmap base / 16K
     static const int REG_OFF_BITMAP_PALETTE = 10; // [3:0] - Palette index
 
+    static const int REG_OFF_SPRITE_FIRST   = 8;  // First sprite in the sprite list
+    static const int REG_OFF_SPRITE_GRAPHIC = 9;  // Graphics base / 32K, in tile format
+    static const int REG_OFF_SPRITE_COUNT   = 10; // Number of sprites
+
+    // Sprite list entry offsets
+    static const int SPRITE_X_L      = 0;
+    static const int SPRITE_Y_L      = 1;
+    static const int SPRITE_XY       = 2;  // [3:0] - X[11:8], [7:4] - Y[11:8]
+    static const int SPRITE_TILE     = 3;  // Tile [7:0]
+    static const int SPRITE_ATTR     = 4;  // [1:0] - Tile[9:8], [3] - Hidden, [7:4] - Palette index
+    static const int SPRITE_SIZE     = 5;  // [2:0] - Width in tiles - 1, [6:4] - Height in tiles - 1
+
     struct VideoMode {
         int pixelWidth, pixelHeight;
         
@@ -84,26 +122,205 @@ class VideoBeast {
         VideoBeast(char* initialMemFile, float zoom);
         ~VideoBeast();
 
-        void     init(uint64_t clock_time_ps);
+        void     init(uint64_t clock_time_ps, uint64_t clock_cycle_ps);
 
+        // Render everything due up to the given time. Returns the end of the current frame, which is the
+        // next time the renderer has to catch up.
         uint64_t tick(uint64_t clock_time_ps);
+        // Render up to the given time and show a whole frame drawn from the state at that time, for the debugger
+        void     catchUp(uint64_t clock_time_ps);
 
         void     write(uint16_t addr, uint8_t data, uint64_t clock_time_ps);
         uint8_t  read(uint16_t addr, uint64_t clock_time_ps);
 
         void handleEvent(SDL_Event windowEvent);
+
+        // Frames to skip between drawn frames, or FRAME_SKIP_AUTO to skip while the window can't be seen
+        // or emulation isn't keeping pace with real time
+        static const int FRAME_SKIP_AUTO = -1;
+        void setFrameSkip(int frames);
+
+        // Render on a worker thread, fed with journaled writes by the CPU thread. Call before init.
+        void setThreaded(bool threaded);
+
+        // Send every frame to a capture, which also stops frames being skipped. Call before init.
+        void setCapture(FrameCapture *capture);
+
+        // Print the render timing counters and line time histograms
+        void printStats();
+
+        // Vertical blank and line compare interrupts, raised from the raster timing on the CPU's clock so they
+        // never wait for the renderer. Active while a raised interrupt is enabled.
+        inline bool interruptActive(uint64_t clock_time_ps) {
+            if( nextInterrupt_ps <= clock_time_ps ) {
+                raiseInterrupts(clock_time_ps);
+            }
+            return (host_registers[REG_INT_STATUS] & host_registers[REG_INT_ENABLE]) != 0;
+        }
+        uint8_t interruptVector();
     
     private:
+        // The renderer's view of memory, registers, palettes and sprites, as of the time it has caught up to
         uint8_t mem[VIDEO_RAM_LENGTH];
 
         uint8_t registers[REGISTERS_LENGTH];
 
+        uint8_t sprites[SPRITE_RAM_LENGTH];
+
+        // Tile rows (4 bytes of 4bpp pixels) already expanded to palette indices, for every 4 bytes of video
+        // RAM. A row is expanded when first drawn, and invalidated when the renderer applies a write to it.
+        static const int TILE_ROWS = VIDEO_RAM_LENGTH / 4;
+
+        uint64_t tile_rows[TILE_ROWS];
+        uint64_t tile_row_valid[TILE_ROWS / 64];
+
+        inline uint64_t tileRow(uint32_t address) {
+            uint32_t row = (address & (VIDEO_RAM_LENGTH-1)) >> 2;
+            uint64_t bit = 1ULL << (row & 63);
+            if( (tile_row_valid[row >> 6] & bit) == 0 ) {
+                tile_rows[row] = Scanline::expandNibbles(mem + (row << 2));
+                tile_row_valid[row >> 6] |= bit;
+            }
+            return tile_rows[row];
+        }
+
+        // Unchanged line detection. Each frame buffer row keeps the signature of the line drawn into it, and
+        // a line with the same signature is not drawn again.
+        static const int      VRAM_REGION_BITS = 12;
+        static const int      VRAM_REGIONS = VIDEO_RAM_LENGTH >> VRAM_REGION_BITS;
+        static const uint64_t SIGNATURE_BASIS = 0xCBF29CE484222325ULL;  // FNV-1a
+        static const uint64_t SIGNATURE_PRIME = 0x100000001B3ULL;
+
+        uint32_t vram_generation[VRAM_REGIONS];
+        uint32_t paletteGeneration = 0;
+        uint32_t spriteGeneration = 0;
+        uint32_t bucketGeneration = 0;          // Sprite generation the line buckets were built from
+        uint64_t row_signature[2][MAX_LINES];   // For each of frame_buffers, 0 if unknown
+        uint64_t lineSignature = 0;             // The line in line_buffer, 0 if it isn't to be kept
+        bool     drawLine = true;               // Whether the current line is being drawn
+        uint64_t renderTarget_ps = 0;           // Time the renderer is catching up to, with the journal complete
+
+        uint64_t signLine();
+        uint64_t regionSignature(uint64_t signature, uint32_t address, uint32_t length);
+        bool     needsDrawing();
+        void     forgetLine();
+
+        // Foreground (high nibble) and background (low nibble) palette offsets for each text attribute byte
+        uint8_t attribute_colours[ATTRIBUTE_TABLES][256];
+        int     frameCount = 0;
+
+        // Frame skipping. Skipped frames keep all raster and layer timing, but do no pixel work.
+        static const int MAX_AUTO_SKIP = 4;         // Always draw at least one frame in this many
+        static constexpr double MAX_LAG_SECONDS = 0.25;    // Further behind than this, assume emulation was paused
+
+        int      frameSkip = FRAME_SKIP_AUTO;
+        int      skippedFrames = 0;
+        bool     renderFrame = true;
+        uint64_t pacingStartCounter = 0;
+        uint64_t pacingStartPs = 0;
+        std::atomic<uint64_t> lastPresentCounter{0};
+
+        bool shouldRender(uint64_t clock_time_ps);
+
+        FrameCapture *capture = nullptr;
+
+        // The raster as the CPU sees it, worked out from the video mode timings rather than the renderer. A
+        // frame's mode is latched as it starts, and its first line still has the previous frame's line period.
+        bool     rasterStarted = false;
+        uint64_t rasterFrameStart_ps = 0;
+        uint64_t rasterNextFrame_ps = 0;
+        uint64_t rasterFirstLine_ps = 0;
+        uint64_t rasterLine_ps = 0;
+        int      rasterMode = 0;
+        bool     rasterDoubled = false;
+        uint64_t nextInterrupt_ps = 0;
+
+        void     advanceRaster(uint64_t time_ps);
+        uint64_t lineStart(int displayLine);
+        uint16_t rasterLine(uint64_t clock_time_ps);
+        int      interruptLine(uint8_t source);
+        void     raiseInterrupts(uint64_t clock_time_ps);
+        uint64_t nextInterruptAfter(uint64_t clock_time_ps);
+        void     writeInterruptRegister(uint8_t reg, uint8_t data, uint64_t clock_time_ps);
+
+        // Sprites that cover each line of each sprite layer, rebuilt at the start of every frame
+        uint8_t sprite_lines[MAX_LAYERS][MAX_LINES][MAX_SPRITES_PER_LINE];
+        uint8_t sprite_line_count[MAX_LAYERS][MAX_LINES];
+
         uint32_t palette1[PALETTE_LENGTH];
         uint32_t palette2[PALETTE_LENGTH];
 
         uint16_t paletteReg1[PALETTE_LENGTH];
         uint16_t paletteReg2[PALETTE_LENGTH];
 
+        // 0 for transparent entries (bit 15 set), otherwise all ones, for the scanline kernels
+        uint32_t paletteMask1[PALETTE_LENGTH];
+        uint32_t paletteMask2[PALETTE_LENGTH];
+
+        // The CPU's view, which writes change straight away so reads always see them. Each write is also
+        // journaled with its time, and replayed into the renderer's view as the renderer catches up.
+        uint8_t  host_mem[VIDEO_RAM_LENGTH];
+        uint8_t  host_registers[REGISTERS_LENGTH];
+        uint8_t  host_sprites[SPRITE_RAM_LENGTH];
+        uint16_t host_paletteReg1[PALETTE_LENGTH];
+        uint16_t host_paletteReg2[PALETTE_LENGTH];
+
+        // JOURNAL_RENDER and JOURNAL_STOP are only queued for the worker thread
+        enum JournalTarget : uint8_t {JOURNAL_MEM, JOURNAL_REGISTER, JOURNAL_PALETTE_1, JOURNAL_PALETTE_2, JOURNAL_SPRITE,
+                                      JOURNAL_RENDER, JOURNAL_STOP};
+
+        struct JournalEntry {
+            uint64_t time_ps;
+            uint32_t index;         // Byte offset in the target. Palette bytes are 2*entry + high byte.
+                                    // For JOURNAL_RENDER, the request number.
+            uint8_t  target;
+            uint8_t  data;          // For JOURNAL_RENDER, whether to render the step due at time_ps
+        };
+
+        // Catch up early, rather than let a frame of heavy writes grow the journal without limit
+        static const size_t MAX_JOURNAL = 65536;
+
+        std::vector<JournalEntry> journal;
+        size_t journalRead = 0;
+
+        void writeMem(uint32_t address, uint8_t data, uint64_t clock_time_ps);
+        // Journal a write from the CPU thread, either directly or through the worker's queue
+        void publish(uint8_t target, uint32_t index, uint8_t data, uint64_t clock_time_ps);
+        // Have the renderer catch up from the CPU thread, waiting for the worker if asked to
+        void requestRender(uint64_t clock_time_ps, bool inclusive, bool wait);
+        void journalWrite(uint8_t target, uint32_t index, uint8_t data, uint64_t clock_time_ps);
+        void applyJournal(uint64_t clock_time_ps);
+
+        // Run the raster up to a time. Steps due on the same CPU cycle as a read happen after it, so reads
+        // render up to but not including their own cycle.
+        void renderUntil(uint64_t clock_time_ps, bool inclusive);
+        // The first CPU cycle at or after a time, which is when the renderer would have been ticked
+        uint64_t alignToCycle(uint64_t time_ps);
+
+        uint64_t clock_cycle_ps = 1;
+        uint64_t next_step_ps = 0;
+
+        // Worker thread. The CPU thread is the only producer for the queue, and the worker the only consumer.
+        // Everything the renderer owns is only touched by the worker while it runs, except when the CPU
+        // thread has waited for a render request to complete and the worker is idle.
+        static const size_t QUEUE_LENGTH = 1 << 17;         // Power of two
+        static const int    WORKER_SPIN = 1000;             // Polls of an empty queue before sleeping
+
+        bool                      threaded = false;
+        std::thread               worker;
+        std::vector<JournalEntry> queue;
+        std::atomic<size_t>       queueHead{0};             // Next entry for the worker
+        std::atomic<size_t>       queueTail{0};             // Next free entry for the CPU thread
+        std::atomic<bool>         workerSleeping{false};
+        std::mutex                wakeLock;
+        std::condition_variable   workerWake;
+        uint32_t                  renderRequests = 0;
+        std::atomic<uint32_t>     renderedRequest{0};
+
+        void queuePush(const JournalEntry &entry);
+        bool queuePop(JournalEntry &entry);
+        void renderThread();
+
         // Screen modes
         int mode = 0;
         int nextMode = 0;
@@ -123,50 +340,167 @@ class VideoBeast {
 
         uint64_t layer_times_ps[MAX_LAYER_TIMES];
         int      layer_time_index;
-        bool     debug_layers = false;
+        std::atomic<bool>  debug_layers{false};
 
-        float    layer_time_alpha = 0.7;
+        std::atomic<float> layer_time_alpha{0.7f};
         
         int layer_col_r[MAX_LAYER_TIMES];
         int layer_col_g[MAX_LAYER_TIMES];
         int layer_col_b[MAX_LAYER_TIMES];
 
+        // Render timing. Each line's layer time, from clearing the line to finishing the last layer, is
+        // counted against the line period in eighths. Problems are counted rather than printed as they
+        // happen, with at most one summary warning in WARNING_INTERVAL_FRAMES.
+        static const int TIMING_BUCKETS = 16;           // The last bucket also counts anything slower
+        static const int WARNING_INTERVAL_FRAMES = 60;
+
+        struct TimingStats {
+            uint64_t frames = 0;
+            uint64_t lines = 0;
+            uint64_t overrunLines = 0;          // Layers took longer than the line period
+            uint64_t clockSyncErrors = 0;
+            uint64_t lineSyncErrors = 0;
+            uint32_t worstLinePercent = 0;
+            uint64_t linePeriod_ps = 0;         // Of the most recent frame
+            uint64_t histogram[TIMING_BUCKETS] = {};
+
+            void add(const TimingStats &other);
+        };
+
+        TimingStats frameTiming;                // The frame being drawn
+        TimingStats lastFrameTiming;            // For the debug overlay
+        TimingStats totalTiming;
+        TimingStats warningTiming;              // Since the last warning
+        uint64_t    lineStart_ps = 0;
+        bool        lineOverrun = false;
+
+        std::mutex  statsLock;                  // Guards statsLastFrame and statsTotal, for printStats
+        TimingStats statsLastFrame;
+        TimingStats statsTotal;
+
+        void recordLineTime(uint64_t time_ps);
+        void endFrameTiming();
+        void drawTimingOverlay(int row, int width);
+
+        // Write timeline. While showWrites is on, each write is recorded as the renderer applies it, with where
+        // the raster was. A write to a visible line while its layers are being drawn races the renderer.
+        static const int MAX_WRITE_RECORDS = 16384;     // In a frame. Any more are counted but not kept
+        static constexpr const char *WRITES_FILENAME = "videobeast_writes.csv";
+
+        struct WriteRecord {
+            uint32_t index;
+            uint16_t displayLine;
+            uint16_t pixel;             // Pixel clocks into the line, counting blanking
+            uint8_t  layer;             // Layer being drawn, or IDLE
+            uint8_t  target;
+            uint8_t  data;
+            bool     racing;
+        };
+
+        std::atomic<bool>        showWrites{false};
+        std::vector<WriteRecord> frameWrites;
+        uint32_t                 frameWritesDropped = 0;
+
+        std::mutex               writesLock;    // Guards the last frame's writes, for exportWrites
+        std::vector<WriteRecord> lastFrameWrites;
+        uint32_t                 lastFrameWritesDropped = 0;
+        int                      lastFrameWritesNumber = 0;
+
+        void recordWrite(const JournalEntry &entry);
+        void drawWriteMarkers();
+        void endFrameWrites();
+        void exportWrites();
+
         const VideoMode VIDEO_MODE[VIDEO_MODES] = {
             VideoMode{ 640, 480, 800, 525, 40000ULL }, // 25Mhz pixel clock
             VideoMode{ 848, 480, 1088, 517, 29767ULL}  // 33.594Mhz pixel clock
         };
 
-        SDL_Window *window;
-        SDL_Surface *surface;
-        SDL_PixelFormat *pixel_format;
+        SDL_Window *window = nullptr;
+        SDL_Renderer *renderer = nullptr;
+        SDL_Texture *texture = nullptr;
         float requestedZoom = 1.0;
-        float zoom = 2.0;
         uint32_t windowID;
 
         uint32_t line_buffer[MAX_LINE_WIDTH];
 
+        // Palette indices for the layer being drawn, with room for a partial glyph or tile at either end
+        static const int INDEX_PAD = 8;
+        uint8_t  index_buffer[INDEX_PAD + MAX_LINE_WIDTH + INDEX_PAD];
+
+        // Native resolution ARGB frames, uploaded to the texture once per frame and scaled by the renderer.
+        // The renderer draws into frame_buffer and swaps it with ready_buffer when the frame is complete.
+        uint32_t  frame_buffers[2][MAX_LINE_WIDTH * MAX_LINES];
+        uint32_t *frame_buffer = frame_buffers[0];
+        uint32_t *ready_buffer = frame_buffers[1];
+        int       readyMode = 0;
+        bool      readyFresh = false;
+        std::mutex frameLock;                   // Guards ready_buffer, readyMode and readyFresh
+
+        int       windowMode = 0;               // The mode the window is sized for
+
+        // Whole frame drawn for the debugger, with the renderer state it puts back afterwards
+        uint32_t  preview_buffer[MAX_LINE_WIDTH * MAX_LINES];
+        uint32_t  preview_line_buffer[MAX_LINE_WIDTH];
+        uint8_t   preview_sprite_lines[MAX_LAYERS][MAX_LINES][MAX_SPRITES_PER_LINE];
+        uint8_t   preview_sprite_line_count[MAX_LAYERS][MAX_LINES];
+        int       previewMode = 0;
+        uint64_t  previewTime_ps = 0;
+        bool      previewValid = false;
+
         uint32_t background;
 
         // Read a file into graphics ram
         void readMem(char* filename);
 
-        void tickNextFrame();
+        void tickNextFrame(uint64_t clock_time_ps);
+        // Advance the raster by one line or layer, returning the time of the next step
+        uint64_t step(uint64_t clock_time_ps);
+        uint64_t drawLayer(int layerBase);
+        void     copyLine(uint32_t *dest);
+        void     renderPreview();
 
         void createWindow();
-        void updateMode();
-        void checkWindow(int width, int height);
+        void updateMode(int windowMode);
         void clearWindow();
+        void presentFrame(const uint32_t *buffer, int frameMode);
+
+        // Hand a finished frame over to be shown (renderer side), and show it (CPU thread)
+        void finishFrame();
+        void showFrame();
 
-        void loadPalette(const char *filename, uint32_t *palette, uint16_t *paletteReg);
+        void loadPalette(const char *filename, uint32_t *palette, uint16_t *paletteReg, uint32_t *paletteMask);
         void loadRegisters(const char *filename);
 
-        // Get a colour value for the window surface from a packed RGB palette entry
-        uint32_t getColour(uint16_t packedRGB);
+        // Set consecutive palette entries from packed RGB values, as a single palette change
+        void uploadPalette(uint32_t *palette, uint16_t *paletteReg, uint32_t *paletteMask, int first, const uint16_t *colours, int count);
+
+        // ARGB colour for every RGB555 value, built when the output format is chosen
+        uint32_t colour_table[0x8000];
+        void buildColourTable();
+
+        // Get an ARGB colour value for the frame buffer from a packed RGB palette entry
+        uint32_t getColour(uint16_t packedRGB) { return colour_table[packedRGB & 0x7FFF]; }
 
         uint64_t drawTextLayer(int layberBase);
         uint64_t drawTileLayer(int layberBase);
         uint64_t drawBppBitmap(int layberBase);
         uint64_t draw4ppBitmap(int layberBase);
+        uint64_t drawSpriteLayer(int layerBase);
+
+        void bucketSprites();
+        void buildAttributeTables();
+
+        // The video RAM address of each 32 byte slice of the host window, rebuilt when the page map mode or
+        // a page register changes. Slices are the largest unit that stays contiguous in Sinclair mode.
+        static const int      WINDOW_SLICE_BITS = 5;
+        static const int      WINDOW_SLICE = 1 << WINDOW_SLICE_BITS;
+        static const int      WINDOW_SLICES = 0x4000 / WINDOW_SLICE;
+        static const uint32_t UNMAPPED = 0xFFFFFFFF;
+
+        uint32_t windowMap[WINDOW_SLICES];
+
+        void buildWindowMap();
 
         // Sinclair address mode
         uint32_t getSinclairAddress(uint16_t addr);